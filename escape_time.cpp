@@ -0,0 +1,360 @@
+#include <escape_time.h>
+#include <atomic>
+#include <cstdlib>
+#include <cstring>
+#include <cmath>
+
+#if defined(__x86_64__) || defined(__i386__)
+#define ESCAPE_TIME_X86
+#include <immintrin.h>
+#endif
+
+// all kernels evaluate the recurrence with the same operations in the same order
+// (no fma), so they produce bit identical results and can be swapped freely.
+// gcc would fuse the multiplies and adds of the avx512 kernel, fma being part of it
+#if defined(__GNUC__) && !defined(__clang__)
+#pragma GCC optimize("fp-contract=off")
+#endif
+
+// brent's cycle detection: z is saved at iterations 1, 2, 4, 8... and a point whose orbit
+// comes back within this squared distance of the saved z is taken to have reached a cycle
+// and reported at max_iterations. the bound is at the rounding noise of the orbit itself:
+// escaping orbits move that little per step only for points closer to the boundary of the
+// set than the precision of their own coordinates
+static constexpr f64 PERIOD_EPSILON = 1e-30;
+
+// mandelbrot points of the main cardioid and of the period 2 bulb never escape, they are
+// found in closed form. so are those of discs inside the period 3 bulbs at the top and bottom
+// of the cardioid and the period 4 bulb left of the period 2 one, checked to have attracting
+// cycles (multiplier below 0.98) all around their border. such points are reported at
+// max_iterations with their z of 0, without iterating
+static constexpr f64 BULB3_X = -0.12256116687665, BULB3_Y = 0.74486176661974, BULB3_R2 = 0.089 * 0.089;
+static constexpr f64 BULB4_X = -1.3107026413368, BULB4_R2 = 0.056 * 0.056;
+
+static inline bool insideKnownComponent(f64 x, f64 y) {
+    f64 y2 = y * y;
+    f64 xq = x - 0.25, q = xq * xq + y2;
+    f64 x2 = x + 1.0;
+    f64 x3 = x - BULB3_X, y3 = fabs(y) - BULB3_Y;
+    f64 x4 = x - BULB4_X;
+    return q * (q + xq) <= 0.25 * y2 || x2 * x2 + y2 <= 0.0625
+        || x3 * x3 + y3 * y3 <= BULB3_R2 || x4 * x4 + y2 <= BULB4_R2;
+}
+
+static i32 escapeTimeScalar(const EscapeTimeParams &p, const f64 *x, const f64 *y, i32 n, u32 *iterations, f64 *magnitudes,
+                            const std::atomic<bool> *stop) {
+    for (i32 i = 0; i < n; ++i) {
+        f64 zx = p.julia ? x[i] : 0.0;
+        f64 zy = p.julia ? y[i] : 0.0;
+        f64 cx = p.julia ? p.c.x : x[i];
+        f64 cy = p.julia ? p.c.y : y[i];
+        f64 x2 = zx * zx, y2 = zy * zy;
+        u32 iteration = !p.julia && insideKnownComponent(cx, cy) ? p.max_iterations : 0;
+        f64 saved_x = zx, saved_y = zy;
+        u64 check = 1;
+        u32 poll = iteration + STOP_POLL_INTERVAL;
+        while (x2 + y2 <= p.bailout && iteration < p.max_iterations) {
+            if (iteration == poll) {
+                if (stop && stop->load(std::memory_order_relaxed)) return i;
+                poll += STOP_POLL_INTERVAL;
+            }
+            zy = (zx + zx) * zy + cy;
+            zx = x2 - y2 + cx;
+            x2 = zx * zx;
+            y2 = zy * zy;
+            ++iteration;
+            f64 dx = zx - saved_x, dy = zy - saved_y;
+            if (dx * dx + dy * dy <= PERIOD_EPSILON) {
+                iteration = p.max_iterations;
+                break;
+            }
+            if (iteration == check) {
+                saved_x = zx;
+                saved_y = zy;
+                check *= 2;
+            }
+        }
+        iterations[i] = iteration;
+        magnitudes[i] = x2 + y2;
+    }
+    return n;
+}
+
+#ifdef ESCAPE_TIME_X86
+
+// the same test as insideKnownComponent, lanes of the points inside are set
+__attribute__((target("avx2")))
+static inline __m256d insideKnownComponentAVX2(__m256d x, __m256d y) {
+    const __m256d sign = _mm256_set1_pd(-0.0);
+    __m256d y2 = _mm256_mul_pd(y, y);
+    __m256d xq = _mm256_sub_pd(x, _mm256_set1_pd(0.25));
+    __m256d q = _mm256_add_pd(_mm256_mul_pd(xq, xq), y2);
+    __m256d inside = _mm256_cmp_pd(_mm256_mul_pd(q, _mm256_add_pd(q, xq)), _mm256_mul_pd(_mm256_set1_pd(0.25), y2), _CMP_LE_OQ);
+    __m256d x2 = _mm256_add_pd(x, _mm256_set1_pd(1.0));
+    inside = _mm256_or_pd(inside, _mm256_cmp_pd(_mm256_add_pd(_mm256_mul_pd(x2, x2), y2), _mm256_set1_pd(0.0625), _CMP_LE_OQ));
+    __m256d x3 = _mm256_sub_pd(x, _mm256_set1_pd(BULB3_X));
+    __m256d y3 = _mm256_sub_pd(_mm256_andnot_pd(sign, y), _mm256_set1_pd(BULB3_Y));
+    __m256d r3 = _mm256_add_pd(_mm256_mul_pd(x3, x3), _mm256_mul_pd(y3, y3));
+    inside = _mm256_or_pd(inside, _mm256_cmp_pd(r3, _mm256_set1_pd(BULB3_R2), _CMP_LE_OQ));
+    __m256d x4 = _mm256_sub_pd(x, _mm256_set1_pd(BULB4_X));
+    __m256d r4 = _mm256_add_pd(_mm256_mul_pd(x4, x4), y2);
+    return _mm256_or_pd(inside, _mm256_cmp_pd(r4, _mm256_set1_pd(BULB4_R2), _CMP_LE_OQ));
+}
+
+// lanes that escaped or reached a cycle are frozen with a blend so their z stays finite
+// and the final magnitude is the one at the escape iteration. all lanes take the same
+// iteration count until they stop, so they share the checkpoints of the cycle detection
+__attribute__((target("avx2")))
+static i32 escapeTimeAVX2(const EscapeTimeParams &p, const f64 *x, const f64 *y, i32 n, u32 *iterations, f64 *magnitudes,
+                          const std::atomic<bool> *stop) {
+    const __m256d bailout = _mm256_set1_pd(p.bailout);
+    const __m256d one = _mm256_set1_pd(1.0);
+    const __m256d all = _mm256_castsi256_pd(_mm256_set1_epi64x(-1));
+    const __m256d epsilon = _mm256_set1_pd(PERIOD_EPSILON);
+    i32 i = 0;
+    for (; i + 4 <= n; i += 4) {
+        __m256d px = _mm256_loadu_pd(x + i);
+        __m256d py = _mm256_loadu_pd(y + i);
+        __m256d zx = p.julia ? px : _mm256_setzero_pd();
+        __m256d zy = p.julia ? py : _mm256_setzero_pd();
+        __m256d cx = p.julia ? _mm256_set1_pd(p.c.x) : px;
+        __m256d cy = p.julia ? _mm256_set1_pd(p.c.y) : py;
+        __m256d count = _mm256_setzero_pd();
+        __m256d inside = p.julia ? _mm256_setzero_pd() : insideKnownComponentAVX2(cx, cy);
+        __m256d active = _mm256_andnot_pd(inside, all);
+        __m256d saved_x = zx, saved_y = zy;
+        u64 check = 1;
+        u32 poll = STOP_POLL_INTERVAL;
+
+        for (u32 k = 0; k < p.max_iterations; ++k) {
+            if (k == poll) {
+                if (stop && stop->load(std::memory_order_relaxed)) return i;
+                poll += STOP_POLL_INTERVAL;
+            }
+            __m256d x2 = _mm256_mul_pd(zx, zx);
+            __m256d y2 = _mm256_mul_pd(zy, zy);
+            active = _mm256_and_pd(active, _mm256_cmp_pd(_mm256_add_pd(x2, y2), bailout, _CMP_LE_OQ));
+            if (!_mm256_movemask_pd(active)) break;
+            __m256d new_zy = _mm256_add_pd(_mm256_mul_pd(_mm256_add_pd(zx, zx), zy), cy);
+            __m256d new_zx = _mm256_add_pd(_mm256_sub_pd(x2, y2), cx);
+            zx = _mm256_blendv_pd(zx, new_zx, active);
+            zy = _mm256_blendv_pd(zy, new_zy, active);
+            count = _mm256_add_pd(count, _mm256_and_pd(active, one));
+            __m256d dx = _mm256_sub_pd(zx, saved_x), dy = _mm256_sub_pd(zy, saved_y);
+            __m256d distance = _mm256_add_pd(_mm256_mul_pd(dx, dx), _mm256_mul_pd(dy, dy));
+            __m256d periodic = _mm256_and_pd(active, _mm256_cmp_pd(distance, epsilon, _CMP_LE_OQ));
+            inside = _mm256_or_pd(inside, periodic);
+            active = _mm256_andnot_pd(periodic, active);
+            if (k + 1 == check) {
+                saved_x = zx;
+                saved_y = zy;
+                check *= 2;
+            }
+        }
+
+        count = _mm256_blendv_pd(count, _mm256_set1_pd(p.max_iterations), inside);
+        __m256d magnitude = _mm256_add_pd(_mm256_mul_pd(zx, zx), _mm256_mul_pd(zy, zy));
+        _mm_storeu_si128((__m128i *)(iterations + i), _mm256_cvtpd_epi32(count));
+        _mm256_storeu_pd(magnitudes + i, magnitude);
+    }
+    return i + escapeTimeScalar(p, x + i, y + i, n - i, iterations + i, magnitudes + i, stop);
+}
+
+__attribute__((target("avx512f")))
+static inline __mmask8 insideKnownComponentAVX512(__m512d x, __m512d y) {
+    __m512d y2 = _mm512_mul_pd(y, y);
+    __m512d xq = _mm512_sub_pd(x, _mm512_set1_pd(0.25));
+    __m512d q = _mm512_add_pd(_mm512_mul_pd(xq, xq), y2);
+    __mmask8 inside = _mm512_cmp_pd_mask(_mm512_mul_pd(q, _mm512_add_pd(q, xq)), _mm512_mul_pd(_mm512_set1_pd(0.25), y2), _CMP_LE_OQ);
+    __m512d x2 = _mm512_add_pd(x, _mm512_set1_pd(1.0));
+    inside |= _mm512_cmp_pd_mask(_mm512_add_pd(_mm512_mul_pd(x2, x2), y2), _mm512_set1_pd(0.0625), _CMP_LE_OQ);
+    __m512d x3 = _mm512_sub_pd(x, _mm512_set1_pd(BULB3_X));
+    __m512d y3 = _mm512_sub_pd(_mm512_abs_pd(y), _mm512_set1_pd(BULB3_Y));
+    __m512d r3 = _mm512_add_pd(_mm512_mul_pd(x3, x3), _mm512_mul_pd(y3, y3));
+    inside |= _mm512_cmp_pd_mask(r3, _mm512_set1_pd(BULB3_R2), _CMP_LE_OQ);
+    __m512d x4 = _mm512_sub_pd(x, _mm512_set1_pd(BULB4_X));
+    __m512d r4 = _mm512_add_pd(_mm512_mul_pd(x4, x4), y2);
+    return inside | _mm512_cmp_pd_mask(r4, _mm512_set1_pd(BULB4_R2), _CMP_LE_OQ);
+}
+
+__attribute__((target("avx512f")))
+static i32 escapeTimeAVX512(const EscapeTimeParams &p, const f64 *x, const f64 *y, i32 n, u32 *iterations, f64 *magnitudes,
+                            const std::atomic<bool> *stop) {
+    const __m512d bailout = _mm512_set1_pd(p.bailout);
+    const __m512d one = _mm512_set1_pd(1.0);
+    const __m512d epsilon = _mm512_set1_pd(PERIOD_EPSILON);
+    i32 i = 0;
+    for (; i + 8 <= n; i += 8) {
+        __m512d px = _mm512_loadu_pd(x + i);
+        __m512d py = _mm512_loadu_pd(y + i);
+        __m512d zx = p.julia ? px : _mm512_setzero_pd();
+        __m512d zy = p.julia ? py : _mm512_setzero_pd();
+        __m512d cx = p.julia ? _mm512_set1_pd(p.c.x) : px;
+        __m512d cy = p.julia ? _mm512_set1_pd(p.c.y) : py;
+        __m512d count = _mm512_setzero_pd();
+        __mmask8 inside = p.julia ? 0 : insideKnownComponentAVX512(cx, cy);
+        __mmask8 active = ~inside;
+        __m512d saved_x = zx, saved_y = zy;
+        u64 check = 1;
+        u32 poll = STOP_POLL_INTERVAL;
+
+        for (u32 k = 0; k < p.max_iterations; ++k) {
+            if (k == poll) {
+                if (stop && stop->load(std::memory_order_relaxed)) return i;
+                poll += STOP_POLL_INTERVAL;
+            }
+            __m512d x2 = _mm512_mul_pd(zx, zx);
+            __m512d y2 = _mm512_mul_pd(zy, zy);
+            active = _mm512_mask_cmp_pd_mask(active, _mm512_add_pd(x2, y2), bailout, _CMP_LE_OQ);
+            if (!active) break;
+            zy = _mm512_mask_add_pd(zy, active, _mm512_mul_pd(_mm512_add_pd(zx, zx), zy), cy);
+            zx = _mm512_mask_add_pd(zx, active, _mm512_sub_pd(x2, y2), cx);
+            count = _mm512_mask_add_pd(count, active, count, one);
+            __m512d dx = _mm512_sub_pd(zx, saved_x), dy = _mm512_sub_pd(zy, saved_y);
+            __m512d distance = _mm512_add_pd(_mm512_mul_pd(dx, dx), _mm512_mul_pd(dy, dy));
+            __mmask8 periodic = _mm512_mask_cmp_pd_mask(active, distance, epsilon, _CMP_LE_OQ);
+            inside |= periodic;
+            active &= ~periodic;
+            if (k + 1 == check) {
+                saved_x = zx;
+                saved_y = zy;
+                check *= 2;
+            }
+        }
+
+        count = _mm512_mask_mov_pd(count, inside, _mm512_set1_pd(p.max_iterations));
+        __m512d magnitude = _mm512_add_pd(_mm512_mul_pd(zx, zx), _mm512_mul_pd(zy, zy));
+        _mm256_storeu_si256((__m256i *)(iterations + i), _mm512_maskz_cvtpd_epi32(0xff, count));
+        _mm512_storeu_pd(magnitudes + i, magnitude);
+    }
+    return i + escapeTimeScalar(p, x + i, y + i, n - i, iterations + i, magnitudes + i, stop);
+}
+
+#endif // ESCAPE_TIME_X86
+
+// log2 of a positive normal x. x = 2^k * m with m in [sqrt(1/2), sqrt(2)), then
+// log2(m) = 2/ln(2) * atanh(t) with t = (m - 1) / (m + 1), |t| < 0.172. the series stops
+// at t^5, the smoothed count it gives ends up within 2.2e-6 of the f64 one
+static constexpr u32 SQRT_HALF_BITS = 0x3f3504f3;
+static constexpr f32 LOG2_T1 = 2.88539008f, LOG2_T3 = 0.96179669f, LOG2_T5 = 0.57707802f;
+
+static inline f32 fastLog2(f32 x) {
+    u32 bits;
+    std::memcpy(&bits, &x, sizeof(bits));
+    i32 k = (i32)(bits - SQRT_HALF_BITS) >> 23;
+    bits -= (u32)k << 23;
+    f32 m;
+    std::memcpy(&m, &bits, sizeof(m));
+    f32 t = (m - 1.0f) / (m + 1.0f), t2 = t * t;
+    return (f32)k + t * (LOG2_T1 + t2 * (LOG2_T3 + t2 * LOG2_T5));
+}
+
+static void smoothFastScalar(const u32 *iterations, const f64 *magnitudes, i32 n, u32 max_iterations, f32 *smooth) {
+    for (i32 i = 0; i < n; ++i) {
+        if (iterations[i] >= max_iterations) {
+            smooth[i] = max_iterations;
+        } else {
+            smooth[i] = (f32)iterations[i] + 2.0f - fastLog2(fastLog2((f32)magnitudes[i]));
+        }
+    }
+}
+
+#ifdef ESCAPE_TIME_X86
+
+// the same operations as fastLog2, 8 lanes at a time
+__attribute__((target("avx2")))
+static inline __m256 fastLog2AVX2(__m256 x) {
+    __m256i bits = _mm256_castps_si256(x);
+    __m256i k = _mm256_srai_epi32(_mm256_sub_epi32(bits, _mm256_set1_epi32(SQRT_HALF_BITS)), 23);
+    __m256 m = _mm256_castsi256_ps(_mm256_sub_epi32(bits, _mm256_slli_epi32(k, 23)));
+    __m256 one = _mm256_set1_ps(1.0f);
+    __m256 t = _mm256_div_ps(_mm256_sub_ps(m, one), _mm256_add_ps(m, one));
+    __m256 t2 = _mm256_mul_ps(t, t);
+    __m256 series = _mm256_add_ps(_mm256_set1_ps(LOG2_T3), _mm256_mul_ps(t2, _mm256_set1_ps(LOG2_T5)));
+    series = _mm256_add_ps(_mm256_set1_ps(LOG2_T1), _mm256_mul_ps(t2, series));
+    return _mm256_add_ps(_mm256_cvtepi32_ps(k), _mm256_mul_ps(t, series));
+}
+
+// points inside the set compute garbage from their magnitude, the blend drops it.
+// the counts are converted and compared as signed, exact below 2^31
+__attribute__((target("avx2")))
+static void smoothFastAVX2(const u32 *iterations, const f64 *magnitudes, i32 n, u32 max_iterations, f32 *smooth) {
+    const __m256i limit = _mm256_set1_epi32(max_iterations);
+    const __m256 limit_smooth = _mm256_set1_ps(max_iterations);
+    const __m256 two = _mm256_set1_ps(2.0f);
+    i32 i = 0;
+    for (; i + 8 <= n && max_iterations <= INT32_MAX; i += 8) {
+        __m256i count = _mm256_loadu_si256((const __m256i *)(iterations + i));
+        __m128 low = _mm256_cvtpd_ps(_mm256_loadu_pd(magnitudes + i));
+        __m128 high = _mm256_cvtpd_ps(_mm256_loadu_pd(magnitudes + i + 4));
+        __m256 magnitude = _mm256_insertf128_ps(_mm256_castps128_ps256(low), high, 1);
+        __m256 s = _mm256_add_ps(_mm256_cvtepi32_ps(count), two);
+        s = _mm256_sub_ps(s, fastLog2AVX2(fastLog2AVX2(magnitude)));
+        __m256i escaped = _mm256_cmpgt_epi32(limit, count);
+        _mm256_storeu_ps(smooth + i, _mm256_blendv_ps(limit_smooth, s, _mm256_castsi256_ps(escaped)));
+    }
+    smoothFastScalar(iterations + i, magnitudes + i, n - i, max_iterations, smooth + i);
+}
+
+#endif // ESCAPE_TIME_X86
+
+typedef i32 (*EscapeTimeKernel)(const EscapeTimeParams &, const f64 *, const f64 *, i32, u32 *, f64 *, const std::atomic<bool> *);
+
+static EscapeTimeKernel kernelForLevel(SimdLevel level) {
+    switch (level) {
+#ifdef ESCAPE_TIME_X86
+        case SIMD_AVX512: return escapeTimeAVX512;
+        case SIMD_AVX2: return escapeTimeAVX2;
+#endif
+        default: return escapeTimeScalar;
+    }
+}
+
+SimdLevel detectSimdLevel() {
+    SimdLevel level = SIMD_SCALAR;
+#ifdef ESCAPE_TIME_X86
+    __builtin_cpu_init();
+    if (__builtin_cpu_supports("avx512f")) level = SIMD_AVX512;
+    else if (__builtin_cpu_supports("avx2")) level = SIMD_AVX2;
+#endif
+    const char *cap = std::getenv("FEX_SIMD");
+    if (cap) {
+        if (std::strcmp(cap, "scalar") == 0) level = SIMD_SCALAR;
+        else if (std::strcmp(cap, "avx2") == 0 && level > SIMD_AVX2) level = SIMD_AVX2;
+    }
+    return level;
+}
+
+static std::atomic<SimdLevel> kernel_level{detectSimdLevel()};
+
+void setEscapeTimeKernel(SimdLevel level) {
+    if (level > detectSimdLevel()) level = detectSimdLevel();
+    kernel_level = level;
+}
+
+SimdLevel getEscapeTimeKernel() { return kernel_level; }
+
+i32 escapeTime(const EscapeTimeParams &p, const f64 *x, const f64 *y, i32 n, u32 *iterations, f64 *magnitudes,
+               const std::atomic<bool> *stop) {
+    return kernelForLevel(kernel_level)(p, x, y, n, iterations, magnitudes, stop);
+}
+
+void smoothIterations(const u32 *iterations, const f64 *magnitudes, i32 n, u32 max_iterations, bool fast, f32 *smooth) {
+    if (fast) {
+#ifdef ESCAPE_TIME_X86
+        if (kernel_level >= SIMD_AVX2) {
+            smoothFastAVX2(iterations, magnitudes, n, max_iterations, smooth);
+            return;
+        }
+#endif
+        smoothFastScalar(iterations, magnitudes, n, max_iterations, smooth);
+        return;
+    }
+    for (i32 i = 0; i < n; ++i) {
+        if (iterations[i] >= max_iterations) {
+            smooth[i] = max_iterations;
+        } else {
+            smooth[i] = iterations[i] + 2 - std::log2(std::log2(magnitudes[i]));
+        }
+    }
+}
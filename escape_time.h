@@ -0,0 +1,49 @@
+#ifndef escape_time_h
+#define escape_time_h
+
+#include <extramath.h>
+#include <atomic>
+
+// escape time kernels: iterate z = z^2 + c for a batch of points and report
+// how many iterations each point took to leave the bailout radius.
+// the same entry point serves the mandelbrot set (z starts at 0, c is the point)
+// and the julia set (z starts at the point, c is fixed).
+
+enum SimdLevel {
+    SIMD_SCALAR,
+    SIMD_AVX2,   // 4 f64 lanes
+    SIMD_AVX512, // 8 f64 lanes
+};
+
+struct EscapeTimeParams {
+    u32 max_iterations;
+    f64 bailout;        // squared escape radius
+    bool julia;
+    Vec2<f64> c;        // julia parameter, unused for the mandelbrot set
+};
+
+// a stop flag is polled every this many iterations of a point
+static constexpr u32 STOP_POLL_INTERVAL = 1024;
+
+// x and y hold the n points in fractal space. iterations receives the escape
+// iteration (max_iterations if the point never escaped) and magnitudes the squared
+// modulus of z when the point escaped, as needed by smooth coloring.
+// returns the number of points done, n unless stop was raised: the points from the
+// returned index on are left unwritten, their orbits dropped
+i32 escapeTime(const EscapeTimeParams &p, const f64 *x, const f64 *y, i32 n, u32 *iterations, f64 *magnitudes,
+               const std::atomic<bool> *stop = nullptr);
+
+// smoothed escape counts for the kernel output, max_iterations for the points that never
+// escaped: iteration + 1 - log2(log2(|z|)). the exact version takes the logarithms in f64,
+// the fast one in f32 from the exponent bits and a series in the mantissa, which vectorizes.
+// for magnitudes above 2^13 (both bailouts) the fast count is within 2.2e-6 of the exact one,
+// besides the f32 rounding of large counts
+void smoothIterations(const u32 *iterations, const f64 *magnitudes, i32 n, u32 max_iterations, bool fast, f32 *smooth);
+
+// the kernel is picked at startup from the cpu features; FEX_SIMD=scalar|avx2|avx512
+// in the environment caps it, setEscapeTimeKernel overrides it at runtime.
+SimdLevel detectSimdLevel();
+void setEscapeTimeKernel(SimdLevel level);
+SimdLevel getEscapeTimeKernel();
+
+#endif // escape_time_h
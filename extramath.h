@@ -496,6 +496,8 @@ std::istream &operator>>(std::istream &out, Integer &a);
 Integer unsignedAdd(const Integer &x, const Integer &y);
 Integer unsignedSub(const Integer &x, const Integer &y);
 bool  unsignedGreater(const Integer &x, const Integer &y);
+Integer shiftLeft(const Integer &x, u32 bits);
+Integer shiftRight(const Integer &x, u32 bits);
 
 /*
  * Simple rational implementation based on the Integer structure.
@@ -542,6 +544,31 @@ std::ostream &operator<<(std::ostream &out, Rational a);
 //struct Real {
 //};
 
+/*
+ * Fixed point real built on the Integer structure: the value is
+ * mantissa / 2^(32 * precision), so precision counts the 32 bit fraction digits.
+ * Operands of different precision are widened to the larger one.
+ * Meant for quantities of bounded magnitude that need many fraction digits,
+ * like the view center and the reference orbit of a deep zoom.
+ */
+
+struct Fixed {
+    Fixed(f64 x = 0, u32 precision = 2);
+    Fixed(const Integer &mantissa, u32 precision);
+    // a decimal "[-]digits[.digits]" of any length, rounded to the precision
+    Fixed(const std::string &decimal, u32 precision);
+    Fixed withPrecision(u32 precision) const;
+    f64 toDouble() const;
+    Integer mantissa;
+    u32 precision;
+};
+
+Fixed operator+(const Fixed &x, const Fixed &y);
+Fixed operator-(const Fixed &x, const Fixed &y);
+Fixed operator-(const Fixed &x);
+Fixed operator*(const Fixed &x, const Fixed &y);
+std::ostream &operator<<(std::ostream &out, const Fixed &a);
+
 
 #ifdef EXTRA_MATH_IMPLEMENTATION
 
@@ -644,10 +671,39 @@ bool unsignedGreater(const Integer &x, const Integer &y) {
     if (x.digits.size() < y.digits.size()) return false;
     for (isize i = x.digits.size() - 1; i >= 0; --i) {
         if (x.digits[i] > y.digits[i]) return true;
+        if (x.digits[i] < y.digits[i]) return false;
     }
     return false;
 }
 
+Integer shiftLeft(const Integer &x, u32 bits) {
+    u32 limbs = bits / 32, s = bits % 32;
+    Integer z;
+    z.sign = x.sign;
+    z.digits.assign(limbs + x.digits.size() + 1, 0);
+    for (usize i = 0; i < x.digits.size(); ++i) {
+        u64 t = (u64)x.digits[i] << s;
+        z.digits[i + limbs] |= t & 0xffffffff;
+        z.digits[i + limbs + 1] = t >> 32;
+    }
+    z.normalize();
+    return z;
+}
+
+Integer shiftRight(const Integer &x, u32 bits) {
+    u32 limbs = bits / 32, s = bits % 32;
+    Integer z;
+    z.sign = x.sign;
+    z.digits.assign(x.digits.size() > limbs ? x.digits.size() - limbs : 0, 0);
+    for (usize i = 0; i < z.digits.size(); ++i) {
+        u64 lo = x.digits[i + limbs];
+        u64 hi = i + limbs + 1 < x.digits.size() ? x.digits[i + limbs + 1] : 0;
+        z.digits[i] = (((hi << 32) | lo) >> s) & 0xffffffff;
+    }
+    z.normalize();
+    return z;
+}
+
 Integer operator+(const Integer &x, const Integer &y) {
     Integer z;
     if (x.sign != y.sign) {
@@ -743,7 +799,6 @@ i32 leadingZeroes(u32 x) {
 
 // from Algorithm D, The Art of computer programming vol 2. Donald knuth
 std::pair<Integer, Integer> longDivision(Integer u, Integer v, bool compute_remainder) {
-    std::cout << "here" <<std::endl;
     if (v == 0) throw std::invalid_argument("Division bv zero");  
     if (u == 0) return {0, 0};
     if (u < v) return {0, u};
@@ -1116,5 +1171,80 @@ std::ostream &operator<<(std::ostream &out, Rational a) {
 
 
 
+Fixed::Fixed(f64 x, u32 precision) : precision(precision) {
+    mantissa.digits.clear();
+    mantissa.normalize();
+    if (x == 0 || !std::isfinite(x)) return;
+    int e;
+    u64 bits = (u64)std::ldexp(std::frexp(std::abs(x), &e), 53);
+    mantissa.digits = { (u32)(bits & 0xffffffff), (u32)(bits >> 32) };
+    i32 shift = e - 53 + 32 * (i32)precision;
+    mantissa = shift >= 0 ? shiftLeft(mantissa, shift) : shiftRight(mantissa, -shift);
+    if (!mantissa.digits.empty() && x < 0) mantissa.sign = -1;
+}
+
+Fixed::Fixed(const Integer &mantissa, u32 precision) : mantissa(mantissa), precision(precision) { }
+
+Fixed::Fixed(const std::string &decimal, u32 precision) : precision(precision) {
+    std::string digits;
+    usize fraction_digits = 0;
+    bool point = false;
+    for (usize i = 0; i < decimal.size(); ++i) {
+        char ch = decimal[i];
+        if (i == 0 && (ch == '-' || ch == '+')) continue;
+        if (ch == '.' && !point) { point = true; continue; }
+        if (ch < '0' || ch > '9') throw std::invalid_argument("Invalid initializer");
+        digits += ch;
+        if (point) ++fraction_digits;
+    }
+    if (digits.empty()) throw std::invalid_argument("Invalid initializer");
+
+    // digits / 10^fraction_digits, scaled by 2^(32 precision) and rounded
+    Integer scale = pow(Integer(10), (i64)fraction_digits);
+    mantissa = (shiftLeft(Integer(digits), 32 * precision) + shiftRight(scale, 1)) / scale;
+    if (!mantissa.digits.empty() && decimal[0] == '-') mantissa.sign = -1;
+}
+
+Fixed Fixed::withPrecision(u32 p) const {
+    if (p == precision) return *this;
+    if (p > precision) return { shiftLeft(mantissa, 32 * (p - precision)), p };
+    return { shiftRight(mantissa, 32 * (precision - p)), p };
+}
+
+f64 Fixed::toDouble() const {
+    // three digits hold more than the 53 bits of a double
+    f64 r = 0;
+    usize n = mantissa.digits.size();
+    for (usize i = n > 3 ? n - 3 : 0; i < n; ++i) {
+        r += std::ldexp((f64)mantissa.digits[i], 32 * ((i32)i - (i32)precision));
+    }
+    return mantissa.sign * r;
+}
+
+Fixed operator+(const Fixed &x, const Fixed &y) {
+    u32 p = max(x.precision, y.precision);
+    return { x.withPrecision(p).mantissa + y.withPrecision(p).mantissa, p };
+}
+
+Fixed operator-(const Fixed &x, const Fixed &y) {
+    u32 p = max(x.precision, y.precision);
+    return { x.withPrecision(p).mantissa - y.withPrecision(p).mantissa, p };
+}
+
+Fixed operator-(const Fixed &x) {
+    return { -x.mantissa, x.precision };
+}
+
+Fixed operator*(const Fixed &x, const Fixed &y) {
+    u32 p = max(x.precision, y.precision);
+    Integer z = x.withPrecision(p).mantissa * y.withPrecision(p).mantissa;
+    return { shiftRight(z, 32 * p), p };
+}
+
+std::ostream &operator<<(std::ostream &out, const Fixed &a) {
+    out << std::setprecision(17) << a.toDouble() << " (" << 32 * a.precision << " fraction bits)";
+    return out;
+}
+
 #endif // EXTRA_MATH_IMPLEMENTATION
 #endif // extra_math_h
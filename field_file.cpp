@@ -0,0 +1,70 @@
+#include <field_file.h>
+#include <cstring>
+
+// posix
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <fcntl.h>
+#include <unistd.h>
+
+FILE *beginField(const char *filename, const FieldHeader &header) {
+    FILE *fptr = fopen(filename, "wb");
+    if (!fptr) return nullptr;
+
+    FieldHeader h = header;
+    std::memcpy(h.magic, FIELD_MAGIC, sizeof(h.magic));
+    h.version = FIELD_VERSION;
+    h.header_size = sizeof(FieldHeader);
+    h.data_offset = FIELD_DATA_OFFSET;
+    h.center_x[sizeof(h.center_x) - 1] = 0;
+    h.center_y[sizeof(h.center_y) - 1] = 0;
+
+    static const char padding[FIELD_DATA_OFFSET - sizeof(FieldHeader)] = {};
+    if (fwrite(&h, sizeof(h), 1, fptr) != 1 || fwrite(padding, sizeof(padding), 1, fptr) != 1) {
+        fclose(fptr);
+        return nullptr;
+    }
+    return fptr;
+}
+
+bool writeFieldRows(FILE *file, const f32 *rows, i32 width, i32 height) {
+    usize n = (usize)width * height;
+    return fwrite(rows, sizeof(f32), n, file) == n;
+}
+
+bool endField(FILE *file) {
+    return fclose(file) == 0;
+}
+
+bool mapField(const char *filename, MappedField &field) {
+    int fd = open(filename, O_RDONLY);
+    if (fd < 0) return false;
+    struct stat st;
+    if (fstat(fd, &st) != 0 || (u64)st.st_size < FIELD_DATA_OFFSET) {
+        close(fd);
+        return false;
+    }
+    void *map = mmap(nullptr, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (map == MAP_FAILED) return false;
+
+    const FieldHeader *h = (const FieldHeader *)map;
+    u64 data_size = (u64)max(h->width, 0) * max(h->height, 0) * sizeof(f32);
+    if (std::memcmp(h->magic, FIELD_MAGIC, sizeof(h->magic)) != 0 || h->version != FIELD_VERSION
+        || h->data_offset != FIELD_DATA_OFFSET || h->width <= 0 || h->height <= 0
+        || FIELD_DATA_OFFSET + data_size != (u64)st.st_size) {
+        munmap(map, st.st_size);
+        return false;
+    }
+    madvise(map, st.st_size, MADV_SEQUENTIAL); // recoloring reads it once, front to back
+    field.header = h;
+    field.data = (const f32 *)((const char *)map + h->data_offset);
+    field.map = map;
+    field.map_size = st.st_size;
+    return true;
+}
+
+void unmapField(MappedField &field) {
+    if (field.map) munmap(field.map, field.map_size);
+    field = {};
+}
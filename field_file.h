@@ -0,0 +1,48 @@
+#ifndef field_file_h
+#define field_file_h
+
+#include <extramath.h>
+#include <cstdio>
+
+// smoothed iteration counts of a render, to color it again without iterating.
+// a FieldHeader, padded to FIELD_DATA_OFFSET, then width * height f32 rows top to
+// bottom in the byte order of the machine that wrote them. the data starts on a
+// page boundary, so a mapped file is read in place as a plain array.
+
+static constexpr u64 FIELD_DATA_OFFSET = 4096;
+static constexpr char FIELD_MAGIC[8] = {'F', 'E', 'X', 'F', 'I', 'E', 'L', 'D'};
+static constexpr u32 FIELD_VERSION = 1;
+
+struct FieldHeader {
+    char magic[8];
+    u32 version;
+    u32 header_size;      // sizeof(FieldHeader) of the writer
+    u64 data_offset;      // FIELD_DATA_OFFSET
+    i32 width, height;
+    u32 max_iterations;   // the value of the pixels inside the set
+    u32 julia;            // 1 for the julia set of julia_c, 0 for the mandelbrot set
+    f64 julia_c[2];
+    f64 zoom;
+    // the view center as given to the renderer, decimals of up to 1023 digits
+    char center_x[1024];
+    char center_y[1024];
+};
+static_assert(sizeof(FieldHeader) <= FIELD_DATA_OFFSET);
+
+// written band by band like the bitmaps
+FILE *beginField(const char *filename, const FieldHeader &header);
+bool writeFieldRows(FILE *file, const f32 *rows, i32 width, i32 height);
+bool endField(FILE *file);
+
+// a field file mapped read only
+struct MappedField {
+    const FieldHeader *header = nullptr;
+    const f32 *data = nullptr; // header->width * header->height values
+    void *map = nullptr;
+    u64 map_size = 0;
+};
+// false if the file is missing, not a field, empty or not the size its header gives
+bool mapField(const char *filename, MappedField &field);
+void unmapField(MappedField &field);
+
+#endif // field_file_h
@@ -1,62 +1,54 @@
 #include <mandelbrot.h>
 #include <window.h>
+#include <escape_time.h>
 #include <iostream>
 
 #include <algorithm>
+#include <chrono>
 #include <cstring>
 
 // i thread vengono accesi
 // viene generato lavoro e 
 
-FractalExplorer::FractalExplorer(Window *w) {
-    computePixel = &FractalExplorer::computeMandlebrotPixel;
-    window = w;
-    initialize();
+FractalExplorer::FractalExplorer(Vec2<i32> size, bool draw) {
+    escape_params.julia = false;
+    escape_params.bailout = 1 << 16;
+    initialize(size, draw);
 }
 
-FractalExplorer::FractalExplorer(Window *w, Vec2<f64> julia_param) {
+FractalExplorer::FractalExplorer(Vec2<i32> size, Vec2<f64> julia_param, bool draw) {
     c = julia_param;
-    computePixel = &FractalExplorer::computeJuliaPixel;
-    window = w;
-    initialize();
+    escape_params.julia = true;
+    escape_params.bailout = 100 * 100;
+    escape_params.c = c;
+    initialize(size, draw);
 }
 
-void FractalExplorer::initialize() {
-    Vec2<i32> size = window->size();
+void FractalExplorer::initialize(Vec2<i32> size, bool draw) {
+    escape_params.max_iterations = max_iterations;
     canvas = initBuffer(size.x, size.y); 
     fillBuffer(canvas, BLACK);
+    view_height = size.y;
 
-    if (size.x < size.y) {
-        fractal_size.x = 4.0;
-        fractal_size.y = 4.0 / size.x * size.y;
-    } else {
-        fractal_size.y = 4.0;
-        fractal_size.x = 4.0 / size.y * size.x;
-    }
-
-    offset = {-2, -2};
-    zoom_level = 1.0;
-
-    Vec2<f64> center = {(double)canvas->width/2.0, (double)canvas->height/2.0};
-    center = screenToFractal(center);
+    zoom_level = requested_zoom = 1.0;
+    updateFractalSize();
+    center_x = Fixed(-2 + fractal_size.x / 2);
+    center_y = Fixed(-2 + fractal_size.y / 2);
 
-    window->setCanvas(canvas);
-    threads.resize(N_THREAD);
-
-    for (i32 i = 0; i < N_THREAD; ++i) {
-        threads[i] = std::thread(&FractalExplorer::getWorkUnit, this);
-    }
+    focus = {(double)canvas->width/2.0, (double)canvas->height/2.0};
 
     generateFullWorkUnits();
-    startDrawing();
+    if (draw) startDrawing();
+}
+
+// the shorter side of the view spans 4 / zoom_level
+void FractalExplorer::updateFractalSize() {
+    pixel_size = 4.0 / zoom_level / min(canvas->width, view_height);
+    fractal_size = {pixel_size * canvas->width, pixel_size * view_height};
 }
 
 FractalExplorer::~FractalExplorer() {
-    if (finished > 0) stop_drawing = true;
-    alive = false;
-    work_available = true;
-    waiting_condition.notify_all();
-    for (auto &th : threads) { th.join(); }
+    stopDrawing();
     freeBuffer(canvas);
 }
 
@@ -65,7 +57,76 @@ Buffer *FractalExplorer::getCanvas() const {
 }
 
 void FractalExplorer::resizeCanvas(Vec2<i32> size) {
-    stopDrawing();
+    post({ViewCommand::RESIZE, {0, 0}, 1, size});
+}
+
+void FractalExplorer::pan(Vec2<f64> delta) {
+    post({ViewCommand::PAN, delta, 1, {0, 0}});
+}
+
+void FractalExplorer::zoom(Vec2<f64> focus, f64 amount) {
+    post({ViewCommand::ZOOM, focus, amount, {0, 0}});
+}
+
+// pans add up, zooms on the same focus multiply and the last resize wins
+void FractalExplorer::post(const ViewCommand &command) {
+    if (!commands.empty() && commands.back().kind == command.kind) {
+        ViewCommand &last = commands.back();
+        switch (command.kind) {
+        case ViewCommand::RESIZE:
+            last.size = command.size;
+            return;
+        case ViewCommand::PAN:
+            last.vector += command.vector;
+            return;
+        case ViewCommand::ZOOM:
+            if (last.vector.x == command.vector.x && last.vector.y == command.vector.y) {
+                last.amount *= command.amount;
+                return;
+            }
+            break;
+        }
+    }
+    commands.push_back(command);
+}
+
+// stop_drawing reaches the workers within a batch of pixels, so the queued changes
+// are applied at most a few milliseconds after they were posted
+bool FractalExplorer::update() {
+    if (recolor_pending && frame_complete) recolor();
+    if (commands.empty()) return false;
+    stop_drawing = true;
+    if (!drawing.done()) return false;
+    return applyCommands();
+}
+
+// with the workers stopped. every change leaves its work units and the following ones
+// see an incomplete frame, drawing is then started, view update included, once for all
+bool FractalExplorer::applyCommands() {
+    bool resized = false;
+    for (const ViewCommand &command : commands) {
+        switch (command.kind) {
+        case ViewCommand::RESIZE:
+            applyResize(command.size);
+            resized = true;
+            break;
+        case ViewCommand::PAN:
+            applyPan(command.vector);
+            break;
+        case ViewCommand::ZOOM:
+            applyZoom(command.vector, command.amount);
+            break;
+        }
+    }
+    commands.clear();
+    // the changes clear frame_complete, pans of less than a pixel leave a drawn frame alone
+    if (frame_complete) return resized;
+    prioritizeWorkUnits();
+    startDrawing();
+    return resized;
+}
+
+void FractalExplorer::applyResize(Vec2<i32> size) {
     Buffer *newcanvas = initBuffer(size.x, size.y);
 
     for (i32 y = 0; y < size.y; ++y) {
@@ -78,211 +139,507 @@ void FractalExplorer::resizeCanvas(Vec2<i32> size) {
         }
     }
 
-    window->setCanvas(newcanvas);
     freeBuffer(canvas);
     canvas = newcanvas;
+    damage.addAll();
 
     //Vec2<f64> new_fractal_size = screenToFractal({(f64)size.x, (f64)size.y});
     //Vec2<f64> delta_size = new_fractal_size - fractal_size;
     //fractal_size = fractal_size + delta_size;
 
-    if (size.x < size.y) {
-        fractal_size.x = 4.0 / zoom_level;
-        fractal_size.y = (4.0 / size.x * size.y) / zoom_level;
-    } else {
-        fractal_size.y = (4.0) / zoom_level;
-        fractal_size.x = (4.0 / size.y * size.x) / zoom_level;
-    }
+    Vec2<f64> old_fractal_size = fractal_size;
+    view_height = size.y;
+    view_top = 0;
+    updateFractalSize();
+    // the bottom left corner stays put
+    moveCenter((fractal_size - old_fractal_size) / 2.0);
+    anchored = false;
+    focus = {(f64)size.x / 2.0, (f64)size.y / 2.0};
     generateFullWorkUnits();
-    startDrawing();
+    frame_complete = false;
 }
-void FractalExplorer::pan(Vec2<f64> delta) {
-    if (length(delta) == 0) return;
-    stopDrawing();
-
-    Buffer *work = initBuffer(canvas->width, canvas->height);
-    for (i32 y = 0; y < canvas->height; ++y) {
-        for (i32 x = 0; x < canvas->width; ++x) {
-            i32 canvas_index = y * canvas->width + x;
-            i32 work_index = max(0, min(
-                (i32)(y + floor(delta.y)) * canvas->width + (i32)(x + floor(delta.x)), 
-                work->width * work->height
-            ));
-            work->data[work_index] = canvas->data[canvas_index];
+// moves the rows of a width x height plane by (dx, dy), filling the exposed pixels
+template <typename T>
+static void shiftPlane(T *data, i32 width, i32 height, i32 dx, i32 dy, T fill) {
+    i32 moved = max(0, width - abs(dx));
+    for (i32 i = 0; i < height; ++i) {
+        i32 y = dy > 0 ? height - 1 - i : i; // never overwrite a row before it moved
+        T *row = data + y * width;
+        i32 source_y = y - dy;
+        if (source_y < 0 || source_y >= height || moved == 0) {
+            std::fill(row, row + width, fill);
+            continue;
+        }
+        const T *source = data + source_y * width;
+        if (dx >= 0) {
+            std::memmove(row + dx, source, moved * sizeof(T));
+            std::fill(row, row + min(dx, width), fill);
+        } else {
+            std::memmove(row, source - dx, moved * sizeof(T));
+            std::fill(row + moved, row + width, fill);
         }
     }
+}
 
-    std::memcpy(canvas->data, work->data, sizeof(u32) * canvas->height * canvas->width);
-
-    delta.x = delta.x * (fractal_size.x / canvas->width);
-    delta.y = -1 * delta.y * (fractal_size.y / canvas->height);
-    offset = offset - delta;
+// the pixels still on screen move along with their iterations and only the exposed
+// strips are queued. the view moves by whole pixels, the fraction of a pixel left
+// over is carried to the next pan. the origin moves along, so the exposed pixels are
+// computed on the grid of the moved ones and the view is the one a full redraw draws,
+// panning back gives the image it left. the units of an
+// interrupted frame move too: their coarse grids land on the pixels already iterated,
+// the passes skip those, so the frame resumes where it was instead of starting over
+void FractalExplorer::applyPan(Vec2<f64> delta) {
+    pan_remainder += delta;
+    i32 dx = floor(pan_remainder.x), dy = floor(pan_remainder.y);
+    if (dx == 0 && dy == 0) return;
+    pan_remainder.x -= dx;
+    pan_remainder.y -= dy;
+
+    shiftPlane<u32>(canvas->data, canvas->width, canvas->height, dx, dy, getColorHex(BLACK));
+    shiftPlane<u32>(iteration_field.data(), canvas->width, canvas->height, dx, dy, NOT_COMPUTED);
+    shiftPlane<f32>(smooth_field.data(), canvas->width, canvas->height, dx, dy, 0);
+    damage.addAll();
+
+    moveCenter({-dx * pixelSize().x, dy * pixelSize().y});
+    origin.x -= dx;
+    origin.y += dy;
+
+    i32 w = canvas->width, h = canvas->height;
+    std::vector<WorkUnit> moved;
+    if (!frame_complete) {
+        for (WorkUnit u : work_units) {
+            u = {max(u.min_x + dx, 0), min(u.max_x + dx, w), max(u.min_y + dy, 0), min(u.max_y + dy, h)};
+            if (u.min_x < u.max_x && u.min_y < u.max_y) moved.push_back(u);
+        }
+    }
+    work_units.swap(moved);
+    i32 rows_min = dy > 0 ? 0 : max(0, h + dy), rows_max = dy > 0 ? min(dy, h) : h;
+    i32 cols_min = dx > 0 ? 0 : max(0, w + dx), cols_max = dx > 0 ? min(dx, w) : w;
+    // the exposed rows span the screen, the exposed columns only the rows that moved
+    generateWorkUnits(0, w, rows_min, rows_max);
+    generateWorkUnits(cols_min, cols_max, dy > 0 ? rows_max : 0, dy > 0 ? h : rows_min);
+    frame_complete = false;
+}
+void FractalExplorer::applyZoom(Vec2<f64> focus, f64 amount) {
+    // the focus keeps its place on screen. working with offsets from the center
+    // instead of absolute coordinates keeps this exact past f64 precision
+    Vec2<f64> focus_delta = screenToDelta(focus);
+    requested_zoom *= amount;
+    f64 snapped = exp2(round(log2(requested_zoom) * ZOOM_STEPS) / ZOOM_STEPS);
+    if (snapped == zoom_level) return; // less than a step, kept for the next zoom
+    amount = snapped / zoom_level;
+    zoom_level = snapped;
+    updateFractalSize();
+    moveCenter(focus_delta * (1.0 - 1.0 / amount));
+    anchored = false;
+    if (amount > 1.0) {
+        zoomBufferInterpolate(canvas, focus.x, focus.y, amount);
+        damage.addAll();
+    }
+    // regenerate work units..
+    this->focus = focus;
+    generateFullWorkUnits();
+    frame_complete = false;
+}
 
+void FractalExplorer::setView(const Fixed &x, const Fixed &y, f64 zoom, i32 height, i32 top) {
+    stopDrawing();
+    view_height = height > 0 ? height : canvas->height;
+    view_top = top;
+    zoom_level = requested_zoom = zoom;
+    updateFractalSize();
+    center_x = x;
+    center_y = y;
+    anchored = false;
     generateFullWorkUnits();
     startDrawing();
 }
-void FractalExplorer::zoom(Vec2<f64> focus, f64 amount) {
+
+void FractalExplorer::setMaxIterations(u32 iterations) {
     stopDrawing();
-    Vec2<f64> focus_drawing = screenToFractal(focus);
-    zoom_level *= amount;
-    fractal_size /= amount;
-    Vec2<f64> new_focus_drawing = screenToFractal(focus);
-    offset = offset + (focus_drawing - new_focus_drawing);
-    if (amount > 1.0) zoomBufferInterpolate(canvas, focus.x, focus.y, amount);
-    // regenerate work units..
+    max_iterations = escape_params.max_iterations = iterations;
+    redraw();
+}
+
+void FractalExplorer::setBoundaryTracing(bool enabled) {
+    stopDrawing();
+    boundary_tracing = enabled;
+    redraw();
+}
+
+void FractalExplorer::setProgressive(bool enabled) {
+    stopDrawing();
+    progressive = enabled;
+    redraw();
+}
+
+void FractalExplorer::setFastSmoothing(bool enabled) {
+    stopDrawing();
+    fast_smoothing = enabled;
+    redraw();
+}
+
+// before the first view nothing is drawn, the setters only take their value
+void FractalExplorer::redraw() {
+    if (!started) return;
     generateFullWorkUnits();
     startDrawing();
 }
 
+void FractalExplorer::moveCenter(Vec2<f64> delta) {
+    u32 precision = ReferenceOrbit::precisionFor(pixelSize().x);
+    center_x = center_x + Fixed(delta.x, precision);
+    center_y = center_y + Fixed(delta.y, precision);
+}
+
+// run by the first task of every frame, before any pass. a stop leaves the reference
+// cut short, the frame drawing the next view computes it again. a view drawing the
+// same center, zoom and iterations, another band of the image, keeps them
+void FractalExplorer::updateView() {
+    Vec2<f64> center = {center_x.toDouble(), center_y.toDouble()};
+    f64 magnitude = max(max(fabs(center.x), fabs(center.y)), 0.25);
+    deep_zoom = pixelSize().x < magnitude * DEEP_ZOOM_PRECISION;
+    // the pixel nearest to the center of the view takes the grid point nearest to it.
+    // a deep zoom measures its pixels from the center instead
+    if (!anchored && !deep_zoom) {
+        origin.x = llround(center.x / pixelSize().x - canvas->width / 2.0);
+        origin.y = llround(center.y / pixelSize().y + view_height / 2.0);
+        anchored = true;
+    }
+    if (deep_zoom) {
+        u32 precision = ReferenceOrbit::precisionFor(pixelSize().x);
+        center_x = center_x.withPrecision(max(precision, center_x.precision));
+        center_y = center_y.withPrecision(max(precision, center_y.precision));
+        ReferenceView view{center_x, center_y, pixel_size, canvas->width, view_height, max_iterations};
+        if (!reference_valid || !(view == reference_view)) {
+            reference_valid = false;
+            bool computed = escape_params.julia
+                ? reference.computeJulia(center_x, center_y, c, max_iterations, escape_params.bailout, &stop_drawing)
+                : reference.compute(center_x, center_y, max_iterations, escape_params.bailout, &stop_drawing);
+            if (!computed) return;
+
+            // the corners and edge midpoints of the whole view, every band gets the same series
+            f64 w = canvas->width, h = view_height - view_top, t = -view_top;
+            Vec2<f64> probes[8] = {
+                screenToDelta({0, t}), screenToDelta({w, t}), screenToDelta({0, h}), screenToDelta({w, h}),
+                screenToDelta({w / 2, t}), screenToDelta({0, (t + h) / 2}), screenToDelta({w, (t + h) / 2}), screenToDelta({w / 2, h}),
+            };
+            series.compute(reference, length(fractal_size) / 2, probes, 8, max_iterations);
+            reference_view = view;
+            reference_valid = true;
+        }
+    }
+    skipped_iterations = 0;
+    cached_pixels = 0;
+}
+
+// queued work units see stop_drawing and return at once, the running ones leave their tile
+// after the batch of pixels at hand
 void FractalExplorer::stopDrawing() {
     stop_drawing = true;
-    work_unit_lock.lock();
-    work_units.clear();
-    work_unit_lock.unlock();
-    work_available_lock.lock();
-    work_available = false;
-    work_available_lock.unlock();
-    std::unique_lock<std::mutex> lock(finished_lock);
-    all_stopped_condition.wait(lock, [&finished = finished] {  return finished <= 0; });
+    pool.wait(drawing);
+}
+
+void FractalExplorer::waitDrawing() {
+    if (!commands.empty()) {
+        stopDrawing();
+        applyCommands();
+    }
+    pool.wait(drawing);
+    if (recolor_pending && frame_complete) recolor();
 }
 
-// notify threads that it is time to start drawing again
+// hand the generated work units to the pool. a first task updates the view, so the
+// reference orbit and series of a deep zoom are not computed on the thread posting the
+// change. the first pass times the units for splitting even when it is not shown, its
+// pixels are needed by the full pass anyway
 void FractalExplorer::startDrawing() {
+    started = true;
     stop_drawing = false;
-    std::unique_lock<std::mutex> lock(work_available_lock);
-    work_available = true;
-    waiting_condition.notify_all();
+    frame_complete = false;
+    pool.submit([this] {
+        updateView();
+        if (!stop_drawing) submitPass(PROGRESSIVE_STEP);
+    }, &drawing);
+}
+
+// the last work unit of a pass to finish starts the next, finer one
+// tasks take the units in priority order whatever order the pool runs them in
+void FractalExplorer::submitPass(i32 step) {
+    if (work_units.empty()) {
+        frame_complete = true;
+        return;
+    }
+    // the last task may split the units and start the next pass before this loop ends
+    size_t units = work_units.size();
+    next_unit = 0;
+    pass_remaining = units;
+    unit_costs.assign(units, 0);
+    for (size_t i = 0; i < units; ++i) {
+        pool.submit([this, step] {
+            i32 index = next_unit++;
+            if (!stop_drawing) {
+                auto start = std::chrono::steady_clock::now();
+                doWorkUnit(work_units[index], step);
+                unit_costs[index] = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+            }
+            if (--pass_remaining != 0 || stop_drawing) return;
+            if (step > 1) {
+                splitCostlyUnits();
+                submitPass(progressive ? step / 2 : 1);
+            } else {
+                frame_complete = true;
+            }
+        }, &drawing);
+    }
 }
 
 void FractalExplorer::generateFullWorkUnits() {
-    i32 step = max(50, min(canvas->width, canvas->height) / 10);
+    work_units.clear();
+    iteration_field.assign(canvas->width * canvas->height, NOT_COMPUTED);
+    smooth_field.resize(canvas->width * canvas->height);
+    generateWorkUnits(0, canvas->width, 0, min(canvas->height, view_height - view_top));
+    prioritizeWorkUnits();
+}
 
-    for (i32 y = 0; y < canvas->height; y += step) {
-        for (i32 x = 0; x < canvas->width; x += step) {
-            work_units.push_back({
-                x, min(x + step, canvas->width), y, min(y + step, canvas->height)
-            });
+// splits a rectangle of the screen in tiles
+void FractalExplorer::generateWorkUnits(i32 min_x, i32 max_x, i32 min_y, i32 max_y) {
+    i32 step = max(50, min(canvas->width, canvas->height) / 10);
+    for (i32 y = min_y; y < max_y; y += step) {
+        for (i32 x = min_x; x < max_x; x += step) {
+            work_units.push_back({x, min(x + step, max_x), y, min(y + step, max_y)});
         }
     }
 }
 
-void FractalExplorer::doWorkUnit(WorkUnit w) {
-    i32 draw_width = w.max_x - w.min_x; 
-    i32 draw_height = w.max_y - w.min_y;
-    Buffer *work_buffer = initBuffer(draw_width, draw_height);
-    for (i32 y = 0; y < draw_height; ++y) {
-        for (i32 x = 0; x < draw_width; ++x) {
-            Color color = (*this.*computePixel)(x + w.min_x, y + w.min_y);
-            fillPixel(work_buffer , x, y, color);
-        }
+// a pass is a preview of the next one, which computes the pixels in between: a unit takes
+// about the same share of both. units costing more than their share of the workers' time
+// would be the last ones running, they are split in place so the order still follows the
+// focus. halves are cut on the grid of the first pass, keeping the pixels of the coarse
+// passes at their place in the units
+void FractalExplorer::splitCostlyUnits() {
+    u64 total = 0;
+    for (u64 cost : unit_costs) total += cost;
+    u64 share = total / (pool.size() * UNITS_PER_WORKER);
+    std::vector<WorkUnit> units;
+    units.reserve(work_units.size());
+    for (size_t i = 0; i < work_units.size(); ++i) {
+        splitWorkUnit(work_units[i], unit_costs[i], share, units);
     }
+    work_units.swap(units);
+}
 
-    for (i32 y = 0; y < draw_height; ++y) {
+// the cost is taken to spread evenly over the unit
+void FractalExplorer::splitWorkUnit(WorkUnit w, u64 cost, u64 share, std::vector<WorkUnit> &out) {
+    i32 half_x = (w.max_x - w.min_x) / 2 / PROGRESSIVE_STEP * PROGRESSIVE_STEP;
+    i32 half_y = (w.max_y - w.min_y) / 2 / PROGRESSIVE_STEP * PROGRESSIVE_STEP;
+    if (cost <= share || (half_x == 0 && half_y == 0)) {
+        out.push_back(w);
+        return;
+    }
+    i32 mid_x = w.min_x + half_x, mid_y = w.min_y + half_y;
+    if (half_x == 0) {
+        splitWorkUnit({w.min_x, w.max_x, w.min_y, mid_y}, cost / 2, share, out);
+        splitWorkUnit({w.min_x, w.max_x, mid_y, w.max_y}, cost / 2, share, out);
+    } else if (half_y == 0) {
+        splitWorkUnit({w.min_x, mid_x, w.min_y, w.max_y}, cost / 2, share, out);
+        splitWorkUnit({mid_x, w.max_x, w.min_y, w.max_y}, cost / 2, share, out);
+    } else {
+        splitWorkUnit({w.min_x, mid_x, w.min_y, mid_y}, cost / 4, share, out);
+        splitWorkUnit({mid_x, w.max_x, w.min_y, mid_y}, cost / 4, share, out);
+        splitWorkUnit({w.min_x, mid_x, mid_y, w.max_y}, cost / 4, share, out);
+        splitWorkUnit({mid_x, w.max_x, mid_y, w.max_y}, cost / 4, share, out);
+    }
+}
+
+// the area around the focus converges first
+void FractalExplorer::prioritizeWorkUnits() {
+    auto focus_distance = [this](const WorkUnit &w) {
+        Vec2<f64> center = {(w.min_x + w.max_x) / 2.0, (w.min_y + w.max_y) / 2.0};
+        return length(center - focus);
+    };
+    std::stable_sort(work_units.begin(), work_units.end(), [&](const WorkUnit &a, const WorkUnit &b) {
+        return focus_distance(a) < focus_distance(b);
+    });
+}
+
+void FractalExplorer::doWorkUnit(WorkUnit w, i32 step) {
+    Tile tile{w, step, (w.max_x - w.min_x + step - 1) / step, (w.max_y - w.min_y + step - 1) / step};
+    // the coarse passes are too sparse to trust a traced border, they iterate every pixel
+    if (boundary_tracing && step == 1) {
+        subdivideTile(tile, 0, 0, tile.width, tile.height);
+    } else {
+        computeRect(tile, 0, 0, tile.width, tile.height, false);
+    }
+
+    if (!progressive && step > 1) return;
+
+    // every pixel of the pass paints the step x step block it stands for, the following
+    // passes overwrite all but its own pixel. pixels of the block already iterated, moved
+    // there by a pan, keep their color
+    std::vector<f32> row(tile.width);
+    std::vector<u32> colors(tile.width);
+    f32 offset = palette_offset;
+    for (i32 y = 0; y < tile.height; ++y) {
         if (stop_drawing) break;
-        for (i32 x = 0; x < draw_width; ++x) {
-            if (stop_drawing) break;
-            u32 hex = work_buffer->data[y*draw_width + x];
-            canvas->data[x+w.min_x + (y+w.min_y)*canvas->width] = hex;
+        for (i32 x = 0; x < tile.width; ++x) row[x] = smooth_field[fieldIndex(tile, x, y)];
+        colorField(row.data(), tile.width, max_iterations, offset, colors.data());
+        i32 block_min_y = w.min_y + y * step, block_max_y = min(block_min_y + step, w.max_y);
+        for (i32 x = 0; x < tile.width; ++x) {
+            i32 block_min_x = w.min_x + x * step, block_max_x = min(block_min_x + step, w.max_x);
+            for (i32 by = block_min_y; by < block_max_y; ++by) {
+                for (i32 bx = block_min_x; bx < block_max_x; ++bx) {
+                    i32 index = by * canvas->width + bx;
+                    if (index != fieldIndex(tile, x, y) && iteration_field[index] != NOT_COMPUTED) continue;
+                    canvas->data[index] = colors[x];
+                }
+            }
         }
     }
+    damage.add({w.min_x, w.max_x, w.min_y, w.max_y});
+}
 
-    freeBuffer(work_buffer);
-}
-
-void FractalExplorer::getWorkUnit() {
-    WorkUnit w;
-    while (alive) {
-        work_available_lock.lock();
-        ++finished;
-        work_available_lock.unlock();
-        while (!stop_drawing) {
-            work_unit_lock.lock();
-            if (!work_units.empty()) {
-                w = work_units.back();
-                work_units.pop_back();
-                work_unit_lock.unlock();
-                doWorkUnit(w);
-            } else {
-                work_unit_lock.unlock();
-                std::unique_lock<std::mutex> lock(work_available_lock);
-                work_available = false;
-                break;
+// pixels moved by a pan keep the colors they had, so a frame started after the palette
+// changed is recolored too once complete
+void FractalExplorer::recolor() {
+    recolor_pending = !frame_complete;
+    if (recolor_pending) return;
+    f32 offset = palette_offset;
+    pool.parallelFor(0, canvas->height, 16, [&](i32 first, i32 last) {
+        usize begin = (usize)first * canvas->width;
+        colorField(&smooth_field[begin], (usize)(last - first) * canvas->width, max_iterations, offset, &canvas->data[begin]);
+    });
+    damage.addAll();
+}
+
+void FractalExplorer::setPaletteOffset(f32 offset) {
+    palette_offset = fmodf(offset, (f32)PALETTE_SIZE);
+    recolor();
+}
+
+// iterates the pixels of a rectangle of the tile, or only those on its border, skipping the
+// ones already computed. they all go through the kernel in a single batch, so its lanes stay busy
+void FractalExplorer::computeRect(Tile &t, i32 min_x, i32 min_y, i32 max_x, i32 max_y, bool border_only) {
+    std::vector<i32> indices;
+    std::vector<f64> xs, ys;
+
+    // outside deep zoom every pixel is a sample of the tile cache, the one of its grid
+    // index at the pixel size, and takes its count from there once a view computed it
+    bool cached = cache.enabled() && !deep_zoom;
+    TileKey key{escape_params.julia, escape_params.julia ? c : Vec2<f64>{0, 0}, max_iterations, fast_smoothing, pixel_size, 0, 0};
+    TileCursor cursor(cache, key);
+    i32 hits = 0;
+    std::vector<CacheTile *> sample_tiles;
+    std::vector<i32> samples;
+    size_t most = border_only ? 2 * (max_x - min_x + max_y - min_y) : (max_x - min_x) * (max_y - min_y);
+    indices.reserve(most);
+    xs.reserve(most);
+    ys.reserve(most);
+    if (cached) {
+        sample_tiles.reserve(most);
+        samples.reserve(most);
+    }
+
+    for (i32 y = min_y; y < max_y; ++y) {
+        bool full_row = !border_only || y == min_y || y == max_y - 1;
+        i32 step = full_row ? 1 : max(1, max_x - 1 - min_x);
+        for (i32 x = min_x; x < max_x; x += step) {
+            i32 index = fieldIndex(t, x, y);
+            if (iteration_field[index] != NOT_COMPUTED) continue;
+            Vec2<f64> screen{(f64)(t.unit.min_x + x * t.step), (f64)(t.unit.min_y + y * t.step)};
+            Vec2<f64> p = deep_zoom ? screenToDelta(screen) : screenToFractal(screen);
+            if (cached) {
+                i32 sample;
+                CacheTile *tile = cursor.at(origin.x + (i64)screen.x, origin.y - view_top - (i64)screen.y, sample);
+                if (tile->iterations[sample] != NOT_COMPUTED) {
+                    iteration_field[index] = tile->iterations[sample];
+                    smooth_field[index] = tile->smooth[sample];
+                    ++hits;
+                    continue;
+                }
+                sample_tiles.push_back(tile);
+                samples.push_back(sample);
             }
+            indices.push_back(index);
+            xs.push_back(p.x);
+            ys.push_back(p.y);
         }
-        work_available_lock.lock();
-        if (--finished <= 0) {
-            finished_lock.lock();
-            all_stopped_condition.notify_one();
-            finished_lock.unlock();
-        }
-        work_available_lock.unlock();
-        std::unique_lock<std::mutex> lock(work_available_lock);
-        waiting_condition.wait(lock, [&work_available = work_available] { return work_available; });
+    }
+
+    cached_pixels += hits;
+
+    // the kernels poll stop_drawing as they iterate. a stopped view keeps the pixels done,
+    // the rest stay NOT_COMPUTED and the next pass over the tile starts from them
+    i32 count = indices.size();
+    if (count == 0) return;
+    std::vector<u32> iterations(count);
+    std::vector<f64> magnitudes(count);
+    if (deep_zoom) {
+        count = perturbationEscapeTime(reference, &series, xs.data(), ys.data(), count,
+                                       max_iterations, escape_params.bailout, iterations.data(), magnitudes.data(), &stop_drawing);
+        skipped_iterations += (u64)series.skipped * count;
+    } else {
+        count = escapeTime(escape_params, xs.data(), ys.data(), count, iterations.data(), magnitudes.data(), &stop_drawing);
+    }
+    if (count == 0) return;
+    std::vector<f32> smooth(count);
+    smoothIterations(iterations.data(), magnitudes.data(), count, max_iterations, fast_smoothing, smooth.data());
+    for (i32 i = 0; i < count; ++i) {
+        iteration_field[indices[i]] = iterations[i];
+        smooth_field[indices[i]] = smooth[i];
+    }
+    for (i32 i = 0; i < (i32)samples.size() && i < count; ++i) {
+        sample_tiles[i]->iterations[samples[i]] = iterations[i];
+        sample_tiles[i]->smooth[samples[i]] = smooth_field[indices[i]];
     }
 }
 
-Color (FractalExplorer::*computePixel)(i32, i32);
+// mariani-silver: iterate only the border of the rectangle. the filled-in sets are simply
+// connected, so a border entirely inside the set encloses only points of the set and the
+// rectangle is filled. a border escaping all at the same iteration is taken to enclose a
+// band of that iteration, filled interpolating the smooth values of its left and right sides.
+// any other rectangle is split in four, the children sharing the middle row and column.
+// pixels already iterated by a coarser pass are kept as they are.
+// the fill is approximate: pixels are samples, and a filament thinner than a pixel can
+// cross the border between two of them, its pixels inside then take the border's count.
+// checking more pixels inside catches none of these, so tracing is off unless asked for.
+void FractalExplorer::subdivideTile(Tile &t, i32 min_x, i32 min_y, i32 max_x, i32 max_y) {
+    i32 width = max_x - min_x, height = max_y - min_y;
+    if (width <= MIN_SUBDIVISION || height <= MIN_SUBDIVISION) {
+        computeRect(t, min_x, min_y, max_x, max_y, false);
+        return;
+    }
 
-Color FractalExplorer::computeMandlebrotPixel(i32 px, i32 py) {
-    Vec2<f64> v0{(f64)px, (f64)py};
-    v0 = screenToFractal(v0);
-    Vec2<f64> v{0, 0};
-    f64 x2 = 0, y2 = 0;
-    f64 iteration = 0;
+    computeRect(t, min_x, min_y, max_x, max_y, true);
+    if (stop_drawing) return; // the border may be incomplete
 
-    while (x2 + y2 <= (1 << 16) && iteration < max_iterations) {
-        v.y = (v.x + v.x) * v.y + v0.y;
-        v.x = x2 - y2 + v0.x;
-        x2 = sqr(v.x);
-        y2 = sqr(v.y);
-        iteration += 1;
+    u32 border = iteration_field[fieldIndex(t, min_x, min_y)];
+    bool uniform = true;
+    for (i32 x = min_x; x < max_x && uniform; ++x) {
+        uniform = iteration_field[fieldIndex(t, x, min_y)] == border && iteration_field[fieldIndex(t, x, max_y - 1)] == border;
     }
-
-    Color c;
-    if (iteration < max_iterations) {
-        f64 log_zn = log(v.x*v.x + v.y*v.y) / 2;
-        f64 nu = log(log_zn / log(2)) / log(2);
-        iteration = iteration + 1 - nu;
-        Color c2 = getPaletteColor(floor(iteration));
-        Color c1 = getPaletteColor(floor(iteration) + 1);
-        float frac = iteration - floor(iteration);
-        c = {
-            frac * c1.r + (1 - frac) * c2.r, 
-            frac * c1.g + (1 - frac) * c2.g, 
-            frac * c1.b + (1 - frac) * c2.b
-        };
-    } else c = {0, 0, 0};
-    return c;
-}
-
-Color FractalExplorer::computeJuliaPixel(i32 px, i32 py) {
-    Vec2<f64> z{(f64)px, (f64)py};
-    z = screenToFractal(z);
-    static constexpr double R = 100;
-    f64 iteration = 0;
-
-    while (z.x * z.x + z.y * z.y < R * R && iteration < max_iterations) {
-        f64 xtemp = z.x * z.x - z.y * z.y;
-        z.y = 2.0 * z.x * z.y + c.y; 
-        z.x = xtemp + c.x; 
-        iteration += 1;
+    for (i32 y = min_y; y < max_y && uniform; ++y) {
+        uniform = iteration_field[fieldIndex(t, min_x, y)] == border && iteration_field[fieldIndex(t, max_x - 1, y)] == border;
     }
 
-    Color color;
-    if (iteration < max_iterations) {
-        f64 log_zn = log(z.x*z.x + z.y*z.y) / 2;
-        f64 nu = log(log_zn / log(2)) / log(2);
-        iteration = iteration + 1 - nu;
-        Color c2 = getPaletteColor(floor(iteration));
-        Color c1 = getPaletteColor(floor(iteration) + 1);
-        float frac = iteration - floor(iteration);
-        color = {
-            frac * c1.r + (1 - frac) * c2.r, 
-            frac * c1.g + (1 - frac) * c2.g, 
-            frac * c1.b + (1 - frac) * c2.b
-        };
-    } else { 
-        color = {0, 0, 0};
+    if (uniform) {
+        for (i32 y = min_y + 1; y < max_y - 1; ++y) {
+            f32 left = smooth_field[fieldIndex(t, min_x, y)];
+            f32 right = smooth_field[fieldIndex(t, max_x - 1, y)];
+            for (i32 x = min_x + 1; x < max_x - 1; ++x) {
+                i32 index = fieldIndex(t, x, y);
+                if (iteration_field[index] != NOT_COMPUTED) continue;
+                f32 frac = (f32)(x - min_x) / (width - 1);
+                iteration_field[index] = border;
+                smooth_field[index] = left + (right - left) * frac;
+            }
+        }
+        return;
     }
-    return color;
+
+    i32 mid_x = min_x + width / 2, mid_y = min_y + height / 2;
+    subdivideTile(t, min_x, min_y, mid_x + 1, mid_y + 1);
+    subdivideTile(t, mid_x, min_y, max_x, mid_y + 1);
+    subdivideTile(t, min_x, mid_y, mid_x + 1, max_y);
+    subdivideTile(t, mid_x, mid_y, max_x, max_y);
 }
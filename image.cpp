@@ -0,0 +1,366 @@
+#include <mandelbrot.h>
+#include <window.h>
+#include <thread_pool.h>
+#include <cstdio>
+#include <cstdlib>
+#include <memory>
+
+// palettes, buffer operations and bitmap output shared by fex and fex-render
+
+Color HSVtoRGB(Vec3f c) {
+    int i = floor(c.x * 6);
+    float f = c.x * 6 - i;
+    float p = c.z * (1 - c.y);
+    float q = c.z * (1 - f * c.y);
+    float t = c.z * (1 - (1 - f) * c.y);
+
+    Color result;
+    switch(i % 6){
+        case 0: result.r = c.z, result.g = t,   result.b = p; break;
+        case 1: result.r = q,   result.g = c.z, result.b = p; break;
+        case 2: result.r = p,   result.g = c.z, result.b = t; break;
+        case 3: result.r = p,   result.g = q,   result.b = c.z; break;
+        case 4: result.r = t,   result.g = p,   result.b = c.z; break;
+        case 5: result.r = c.z, result.g = p,   result.b = q; break;
+    }
+
+    return result;
+}
+
+static constexpr usize palette_size = PALETTE_SIZE;
+static Color palette[palette_size];
+
+// the palette baked for coloring: PALETTE_SUBSTEPS packed colors from each entry to the next,
+// plus the first one again so a blend never wraps. a new palette is baked into a new table
+// swapped in whole, a colorField running meanwhile keeps the table it started with
+static constexpr i32 lut_size = PALETTE_SIZE * PALETTE_SUBSTEPS;
+struct PaletteTable { u32 colors[lut_size + 1]; };
+static std::shared_ptr<const PaletteTable> palette_table = std::make_shared<PaletteTable>();
+static bool palette_blending = false;
+
+static void bakePalette() {
+    std::shared_ptr<PaletteTable> table = std::make_shared<PaletteTable>();
+    u32 *palette_lut = table->colors;
+    for (i32 i = 0; i < lut_size; ++i) {
+        Color c2 = palette[i / PALETTE_SUBSTEPS];
+        Color c1 = palette[(i / PALETTE_SUBSTEPS + 1) % palette_size];
+        float frac = (float)(i % PALETTE_SUBSTEPS) / PALETTE_SUBSTEPS;
+        palette_lut[i] = getColorHex({
+            frac * c1.r + (1 - frac) * c2.r,
+            frac * c1.g + (1 - frac) * c2.g,
+            frac * c1.b + (1 - frac) * c2.b
+        });
+    }
+    palette_lut[lut_size] = palette_lut[0];
+    std::atomic_store(&palette_table, std::shared_ptr<const PaletteTable>(std::move(table)));
+}
+
+void generatePalette() {
+    float theta = 0.6f; // warm colors
+    float value = 0.2f;
+    float saturation = 1.0f;
+    int increase = 0;
+    //float theta = 0.1f; // green style
+    for (usize i = 0; i < palette_size; ++i) {
+        switch (increase) {
+            case 0: 
+                value += 0.1;
+                break;
+            case 1: 
+                saturation -= 0.1;
+                break;
+            case 2: 
+                theta += 0.1;
+                value = 0.2f;
+                increase = 0;
+                break;
+            default: exit(EXIT_FAILURE);
+        }
+
+        if (saturation <= 0.5f) {
+            saturation = 1.0f;
+            increase = 2;
+        } else if (theta >= 1.0f) {
+            theta = 0.0f;
+        } else if (value >= 1.0f) {
+            value = 1.0f;
+            increase = 1;
+        }
+
+
+        palette[i] = HSVtoRGB({theta, saturation, value});
+    }
+    bakePalette();
+}
+
+void generatePaletteMonochrome(float hue) {
+    float step = 2.0f / (float)palette_size;
+    float value = 0.2f; 
+    float saturation = 1.0f;
+    bool increase_value = true;
+    //float value = 0.1f; // green style
+    for (usize i = 0; i < palette_size; ++i) {
+        palette[i] = HSVtoRGB({hue, saturation, value});
+        if (increase_value) {
+            value += step;
+        } else {
+            saturation -= step;
+        }
+        if (saturation <= 0.0) saturation = 0.0f;
+        if (value > 1.0f) { 
+            value = 1.0f;
+            increase_value = false;
+        }
+    }
+    bakePalette();
+}
+
+Color getPaletteColor(u32 i) { return palette[i % palette_size]; }
+
+void setPaletteBlending(bool enabled) { palette_blending = enabled; }
+
+// the coloring stage, run over whole rows of a field. the loops have no branches: every pixel
+// loads its table entry, the index clamped into the table, and the ones inside the set select
+// black after. with the pointers restrict, gcc -O3 vectorizes both loops, with gathers under
+// -mavx2 or -mavx512f (see -fopt-info-vec). counts past 2^31 are not expected, the limit is black anyway
+void colorField(const f32 *__restrict smooth, usize n, u32 max_iterations, f32 offset, u32 *__restrict colors) {
+    constexpr u32 black = getColorHex(BLACK);
+    std::shared_ptr<const PaletteTable> table = std::atomic_load(&palette_table);
+    const u32 *__restrict palette_lut = table->colors;
+    f32 limit = max_iterations;
+    if (!palette_blending) {
+        for (usize i = 0; i < n; ++i) {
+            f32 s = max(smooth[i], 0.0f) + offset;
+            s -= (f32)(i32)(s * (1.0f / PALETTE_SIZE)) * PALETTE_SIZE;
+            i32 j = max(min((i32)(s * PALETTE_SUBSTEPS), lut_size - 1), 0);
+            u32 color = palette_lut[j];
+            colors[i] = smooth[i] >= limit ? black : color;
+        }
+        return;
+    }
+    // the sub-step left over weighs the next table color, in 1/256ths. red and blue blend
+    // together in one multiply, the gap of green between them keeps them apart
+    for (usize i = 0; i < n; ++i) {
+        f32 s = max(smooth[i], 0.0f) + offset;
+        s -= (f32)(i32)(s * (1.0f / PALETTE_SIZE)) * PALETTE_SIZE;
+        f32 sub = s * PALETTE_SUBSTEPS;
+        i32 j = max(min((i32)sub, lut_size - 1), 0);
+        u32 w = min((u32)max((sub - j) * 256.0f, 0.0f), 256u);
+        u32 a = palette_lut[j], b = palette_lut[j + 1];
+        u32 rb = (((a & 0xff00ff) * (256 - w) + (b & 0xff00ff) * w) >> 8) & 0xff00ff;
+        u32 g = (((a & 0x00ff00) * (256 - w) + (b & 0x00ff00) * w) >> 8) & 0x00ff00;
+        colors[i] = smooth[i] >= limit ? black : 0xff000000 | rb | g;
+    }
+}
+
+void CanvasDamage::add(DamageRect rect) {
+    if (rect.min_x >= rect.max_x || rect.min_y >= rect.max_y) return;
+    std::lock_guard<std::mutex> guard(lock);
+    rects.push_back(rect);
+}
+
+void CanvasDamage::addAll() {
+    std::lock_guard<std::mutex> guard(lock);
+    rects.assign(1, {0, INT32_MAX, 0, INT32_MAX});
+}
+
+void CanvasDamage::take(std::vector<DamageRect> &out) {
+    std::lock_guard<std::mutex> guard(lock);
+    if (rects.size() > MAX_RECTS) {
+        DamageRect bounds = rects[0];
+        for (const DamageRect &r : rects) {
+            bounds = {min(bounds.min_x, r.min_x), max(bounds.max_x, r.max_x),
+                      min(bounds.min_y, r.min_y), max(bounds.max_y, r.max_y)};
+        }
+        rects.assign(1, bounds);
+    }
+    out.insert(out.end(), rects.begin(), rects.end());
+    rects.clear();
+}
+
+void fillBuffer(Buffer *buf, Color color) {
+    u32 hex = getColorHex(color);
+    ThreadPool::shared().parallelFor(0, buf->height, 64, [&](i32 first, i32 last) {
+        for (i32 i = first * buf->width; i < last * buf->width; ++i) {
+            buf->data[i] = hex;
+        }
+    });
+}
+
+// zooms the buffer in place around the focus, which keeps its place. every pixel blends the
+// four pixels around the point of the old buffer it now shows, read from a copy of it, so
+// the memory is that of the buffer whatever the zoom
+void zoomBufferInterpolate(Buffer *b, i32 focus_x, i32 focus_y, f32 zoom) {
+    std::vector<u32> copy(b->data, b->data + (usize)b->width * b->height);
+    const u32 *src = copy.data();
+    ThreadPool::shared().parallelFor(0, b->height, 32, [&](i32 first, i32 last) {
+        for (i32 y = first; y < last; ++y) {
+            for (i32 x = 0; x < b->width; ++x) {
+                f32 original_x = min(max(focus_x + (x - focus_x) / zoom, 0.0f), (f32)(b->width - 1));
+                f32 original_y = min(max(focus_y + (y - focus_y) / zoom, 0.0f), (f32)(b->height - 1));
+                i32 x1 = original_x;
+                i32 y1 = original_y;
+                i32 x2 = min(x1 + 1, b->width - 1);
+                i32 y2 = min(y1 + 1, b->height - 1);
+                f32 x_frac = original_x - x1;
+                f32 y_frac = original_y - y1;
+                u32 r11 = (src[y1 * b->width + x1] & 0xff0000) >> 16;
+                u32 r12 = (src[y2 * b->width + x1] & 0xff0000) >> 16;
+                u32 r21 = (src[y1 * b->width + x2] & 0xff0000) >> 16;
+                u32 r22 = (src[y2 * b->width + x2] & 0xff0000) >> 16;
+                u32 g11 = (src[y1 * b->width + x1] & 0x00ff00) >>  8;
+                u32 g12 = (src[y2 * b->width + x1] & 0x00ff00) >>  8;
+                u32 g21 = (src[y1 * b->width + x2] & 0x00ff00) >>  8;
+                u32 g22 = (src[y2 * b->width + x2] & 0x00ff00) >>  8;
+                u32 b11 = (src[y1 * b->width + x1] & 0x0000ff) >>  0;
+                u32 b12 = (src[y2 * b->width + x1] & 0x0000ff) >>  0;
+                u32 b21 = (src[y1 * b->width + x2] & 0x0000ff) >>  0;
+                u32 b22 = (src[y2 * b->width + x2] & 0x0000ff) >>  0;
+                f32 rtop = (1 - x_frac) * r11 + x_frac * r21;
+                f32 gtop = (1 - x_frac) * g11 + x_frac * g21;
+                f32 btop = (1 - x_frac) * b11 + x_frac * b21;
+                f32 rbottom = (1 - x_frac) * r12 + x_frac * r22;
+                f32 gbottom = (1 - x_frac) * g12 + x_frac * g22;
+                f32 bbottom = (1 - x_frac) * b12 + x_frac * b22;
+
+                u32 r = (1 - y_frac) * rtop + y_frac * rbottom;
+                u32 g = (1 - y_frac) * gtop + y_frac * gbottom;
+                u32 bl = (1 - y_frac) * btop + y_frac * bbottom;
+
+                u32 hex = (0xffu << 24) | (r << 16) | (g << 8) | (bl << 0);
+                b->data[y * b->width + x] = hex;
+            }
+        }
+    });
+}
+
+void zoomCropBuffer(Buffer *dst, Buffer *src, i32 focus_x, i32 focus_y, f32 zoom) {
+    i32 new_width = (f32)dst->width * zoom;
+    i32 new_height = (f32)dst->height * zoom;
+
+     i32 new_focus_x = (f64)focus_x * zoom;
+     i32 new_focus_y = (f64)focus_y * zoom;
+
+    for (i32 y = 0; y < dst->height; ++y) {
+        for (i32 x = 0; x < dst->height; ++x) {
+            u32 hex = src->data[(y + new_focus_y - focus_y) * new_width + x + (new_focus_x - focus_x)];
+            dst->data[y * dst->width + x] = hex;
+        }
+    }
+}
+
+void blurBufferGaussian(Buffer *buf, u8 kernel_size, f32 sigma) {
+    std::vector<std::vector<f32>> kernel(kernel_size, std::vector<f32>(kernel_size));
+    u8 half_kernel_size = kernel_size / 2;
+
+    f32 kernel_sum = 0.0f;
+    f32 variance_scaled = 2.0 * sigma * sigma;
+
+    for (i32 x = -half_kernel_size; x <= half_kernel_size; ++x) {
+
+        for (i32 y = -half_kernel_size; y <= half_kernel_size; ++y) {
+            f32 r = sqrt(x * x + y * y);
+            kernel[x + half_kernel_size][y + half_kernel_size] = exp(-(r * r) / variance_scaled) / (M_PI * variance_scaled);
+            kernel_sum += kernel[x + half_kernel_size][y + half_kernel_size];
+        }
+    }
+
+    for (i32 i = 0; i < kernel_size; ++i) {
+        for (i32 j = 0; j < kernel_size; ++j) {
+            kernel[i][j] /= kernel_sum;
+        }
+    }
+
+     for (i32 y = half_kernel_size; y < buf->height - half_kernel_size; ++y) {
+        for (i32 x = half_kernel_size; x < buf->width - half_kernel_size; ++x) {
+            f32 sum_red = 0.0, sum_green = 0.0, sum_blue = 0.0;
+            // Alpha can remain the same, no blur on alpha
+            for (i32 ky = -half_kernel_size; ky <= half_kernel_size; ++ky) {
+                for (i32 kx = -half_kernel_size; kx <= half_kernel_size; ++kx) {
+                    i32 pixel = buf->data[(y + ky) * buf->width + x + kx];
+                    f32 weight = kernel[ky + half_kernel_size][kx + half_kernel_size];
+                    // Add weighted values for each channel
+                    sum_red   += ((f32)((pixel & 0xff0000) >> 16)) * weight;
+                    sum_green += ((f32)((pixel & 0x00ff00) >> 8) ) * weight;
+                    sum_blue  += ((f32)((pixel & 0x0000ff) >> 0) ) * weight;
+                }
+            }
+            // Clamp values to 0-255 and combine i32o output pixel
+            u32 blurred_red   = (u32)(min(max(sum_red, 0.0f), 255.0f));
+            u32 blurred_green = (u32)(min(max(sum_green, 0.0f), 255.0f));
+            u32 blurred_blue  = (u32)(min(max(sum_blue, 0.0f), 255.0f));
+            buf->data[y * buf->width + x] = (
+                ((0xffu) << 24) |
+                ((u32)(blurred_red) << 16) | 
+                ((u32)(blurred_green) << 8) | 
+                ((u32)(blurred_blue) << 0) 
+            );
+        }
+    }
+}
+
+// bitmaps are written with their rows top to bottom, as in the buffers
+struct BMPHeader {
+    struct __attribute__((packed)) {
+        u16 magic;               // The header field used to identify the BMP and DIB file is 0x42 0x4D
+        u32 size;                // The size of the BMP file in bytes 
+        u16 reserved0;           // Reserved, if created manually can be 0
+        u16 reserved1;           // Reserved, if created manually can be 0 
+        u32 offset;              // starting address, of the byte where the pixel array can be found. 
+    } header;
+
+    struct __attribute__((packed)) {
+        u32 size;                // 4  the size of this header, in bytes (40) 
+        u32 width;               //   bitmap width in pixels
+        u32 height;              //   bitmap height in pixels
+        u16 n_planes;            //   number of color planes, must be 1
+        u16 bpp;                 //   number of bits per pixel, which is the color depth of the image
+        u32 compression;         //   the compression method being used (0 for no compression)
+        u32 original_size;       //   the image size before compression, if compression == 0, set to 0
+        u32 horizontal_res;      //   the horizontal resolution of the image. (pixel per metre, signed integer)
+        u32 vertical_res;        //   the vertical resolution of the image. (pixel per metre, signed integer)
+        u32 n_palette_colors;    //   the number of colors in the color palette, or 0 to default to 2n
+        u32 n_important_colors;  //   the number of important colors used, or 0 when every color is important
+    } bitmapinfoheader;
+};
+
+FILE *beginBitmap(const char *filename, i32 width, i32 height) {
+    FILE *fptr = fopen(filename, "wb");
+    if (!fptr) return nullptr;
+    u64 data_size = (u64)width * height * sizeof(u32);
+
+    BMPHeader h = {};
+    h.header.magic = 0x4D42;
+    // past 4 GiB the size does not fit, readers go by the dimensions
+    h.header.size = sizeof(h) + data_size > UINT32_MAX ? 0 : sizeof(h) + data_size;
+    h.header.offset = sizeof(h);
+    h.bitmapinfoheader.size = 40;
+    h.bitmapinfoheader.width = width;
+    h.bitmapinfoheader.height = -height; // negative: top to bottom
+    h.bitmapinfoheader.n_planes = 1;
+    h.bitmapinfoheader.bpp = sizeof(u32) * 8;
+    h.bitmapinfoheader.horizontal_res = 500;
+    h.bitmapinfoheader.vertical_res = 500;
+
+    if (fwrite(&h, sizeof(h), 1, fptr) != 1) {
+        fclose(fptr);
+        return nullptr;
+    }
+    return fptr;
+}
+
+bool writeBitmapRows(FILE *file, const Buffer &band) {
+    usize n = (usize)band.width * band.height;
+    return fwrite(band.data, sizeof(u32), n, file) == n;
+}
+
+bool endBitmap(FILE *file) {
+    return fclose(file) == 0;
+}
+
+bool writeBitmap(const char *filename, const Buffer buf) {
+    FILE *fptr = beginBitmap(filename, buf.width, buf.height);
+    if (!fptr) return false;
+    bool written = writeBitmapRows(fptr, buf);
+    return endBitmap(fptr) && written;
+}
@@ -3,11 +3,12 @@
 
 #include <extramath.h>
 #include <window.h>
-#include <thread>
+#include <escape_time.h>
+#include <perturbation.h>
+#include <thread_pool.h>
+#include <tile_cache.h>
 #include <atomic>
-#include <semaphore>
-#include <condition_variable>
-#include <mutex>
+#include <cstdio>
 
 
 //struct Window;
@@ -53,59 +54,228 @@
 //Vec2<i32> getWindowSize(Window *w);
 
 
+// image.cpp
+Color HSVtoRGB(Vec3f c);
+void generatePalette();
+void generatePaletteMonochrome(float hue);
 Color getPaletteColor(u32 i);
+static constexpr u32 PALETTE_SIZE = 200;
+// the generated palettes are baked into a table of packed colors, this many between two entries
+static constexpr i32 PALETTE_SUBSTEPS = 64;
+// colors n smoothed iteration counts from the palette table, black inside the set.
+// offset shifts the palette by that many entries, it wraps every PALETTE_SIZE.
+// colors and smooth must not overlap
+void colorField(const f32 *smooth, usize n, u32 max_iterations, f32 offset, u32 *colors);
+// blend the two nearest table colors instead of taking the nearest one below, off by default.
+// a sub-step is at most a few units of a channel, this smooths them for still images
+void setPaletteBlending(bool enabled);
 
 class FractalExplorer {
-    static constexpr u8 N_THREAD = 16;
     static constexpr float ZOOM_FACTOR = 1.2;
+    // zoom snaps the magnification to 2^(k / ZOOM_STEPS): returning to a zoom gives back its
+    // pixel size bit for bit, and the tile cache serves its pixels
+    static constexpr f64 ZOOM_STEPS = 16;
+    // pixels closer than this, relative to their coordinates, are drawn by perturbation:
+    // f64 keeps 52 bits, the orbits lose the last ones long before the coordinates block up.
+    // the coordinates count from 1/4 up: no point of the mandelbrot boundary is nearer to the
+    // origin, and a julia view nearer to it switches early, which costs nothing. julia sets
+    // are drawn by perturbation too, their pixels starting at their offset from the center
+    static constexpr f64 DEEP_ZOOM_PRECISION = 0x1p-40;
+    static constexpr u32 NOT_COMPUTED = UINT32_MAX;
+    static constexpr i32 MIN_SUBDIVISION = 6; // rectangles this thin are iterated in full
+    static constexpr i32 PROGRESSIVE_STEP = 8;  // pixel stride of the first progressive pass
+    static constexpr u64 UNITS_PER_WORKER = 4;  // a unit costing more than its share of a pass is split
 public:
-    FractalExplorer(Window *w);
-    FractalExplorer(Window *w, Vec2<f64> julia_param);
+    // the explorer draws into its own canvas of the given size, a window shows it
+    // with setCanvas(getCanvas()), again whenever update returns true.
+    // it starts drawing the default view at once, unless draw is false: it then waits
+    // for a setView, the setters before it only take their value
+    FractalExplorer(Vec2<i32> size, bool draw = true);
+    FractalExplorer(Vec2<i32> size, Vec2<f64> julia_param, bool draw = true);
     ~FractalExplorer();
     Buffer *getCanvas() const;
+    // the canvas regions changed, for Window::setCanvas
+    CanvasDamage *getCanvasDamage() { return &damage; }
+    // view changes are queued and return at once, consecutive ones of the same kind merge
+    // into one. update applies them, waitDrawing too
     void resizeCanvas(Vec2<i32> size);
     void pan(Vec2<f64> direction);
     void zoom(Vec2<f64> focus, f64 amount);
+    // for the ui loop, never waits for the workers: the first call after a view change asks
+    // them to stop, a later one finds them stopped, applies the queued changes and starts
+    // drawing again. true when a resize replaced the canvas, to be shown again with setCanvas
+    bool update();
+    // centers the view on (x, y). at zoom 1 the shorter side of the view spans 4.
+    // the view is the canvas, or for an image drawn in bands of full rows one band of it:
+    // the canvas then shows the rows from top on of a view height rows tall. center, zoom
+    // and the path and reference of deep zoom are those of the whole image, so the bands
+    // draw exactly the pixels a single canvas would. the rows of the canvas past the bottom
+    // of the view are not drawn, the last band can reuse the canvas of the others
+    void setView(const Fixed &x, const Fixed &y, f64 zoom, i32 height = 0, i32 top = 0);
+    // the setters of the drawing stop the workers and draw the current view again with the new value
+    void setMaxIterations(u32 iterations);
     void stopDrawing();
+    // blocks until the current view, queued changes included, is completely drawn
+    void waitDrawing();
+    // trace tile borders and fill uniform rectangles instead of iterating every pixel.
+    // off by default: the fill is approximate, a pixel of a filament the samples of a
+    // border missed takes the count of the border
+    void setBoundaryTracing(bool enabled);
+    // render the whole view at 1/8, 1/4, 1/2 and then full resolution, each pass
+    // computing only the pixels the previous ones did not. without it the 1/8 pass
+    // still runs unpainted to time the work units, then the full one
+    void setProgressive(bool enabled);
+    // smooth the escape counts with the approximate f32 logarithms (the default) or the
+    // exact f64 ones, see smoothIterations. the tile cache keeps the counts of each apart
+    void setFastSmoothing(bool enabled);
+    // screen point the user is looking at, tiles nearest to it are drawn first.
+    // zoom moves it to its focus, a resize puts it back on the screen centre
+    void setFocus(Vec2<f64> screen) { focus = screen; }
+    // memory for iteration counts kept across views, 0 turns the cache off.
+    // FEX_CACHE_MB or TileCache::DEFAULT_BUDGET_MB by default, deep zooms do not use it
+    void setCacheBudget(u64 bytes) { cache.setBudget(bytes); }
+    // pixels of the view taken from the tile cache since the view last changed
+    u64 cachedPixels() const { return cached_pixels; }
+    // smoothed iteration count of every canvas pixel, max iterations inside the set.
+    // complete once waitDrawing returns
+    const f32 *getSmoothField() const { return smooth_field.data(); }
+    u32 getMaxIterations() const { return max_iterations; }
+    // colors the view again from getSmoothField after the palette changed, without iterating.
+    // a frame still drawing takes the new palette only for the pixels it has left, the rest
+    // is recolored by the update or waitDrawing that finds it complete
+    void recolor();
+    // shifts the palette by offset entries and recolors, for palette cycling
+    void setPaletteOffset(f32 offset);
+    // iterations the series approximation saved since the view last changed, 0 outside deep zoom
+    u64 skippedIterations() const { return skipped_iterations; }
+    // pixels are square, the shorter side of the view spans 4 / zoom
+    inline Vec2<f64> pixelSize() const {
+        return {pixel_size, pixel_size};
+    }
+    // pixels lie on a grid of the pixel size, pixel (x, y) of the canvas is the point
+    // (origin.x + x, origin.y - view_top - y) of it. a pan moves the origin by whole pixels,
+    // so a pixel gets the same coordinates whichever view it is drawn in
     inline Vec2<f64> screenToFractal(Vec2<f64> p) {
-        p.x = p.x * (fractal_size.x / canvas->width) + offset.x;
-        p.y = (canvas->height - p.y) * (fractal_size.y / canvas->height) + offset.y;
+        p.x = (origin.x + p.x) * pixel_size;
+        p.y = (origin.y - view_top - p.y) * pixel_size;
+        return p;
+    }
+    // offset of a screen point from the view center, exact at any zoom
+    inline Vec2<f64> screenToDelta(Vec2<f64> p) {
+        p.x = (p.x - canvas->width / 2.0) * pixel_size;
+        p.y = (view_height / 2.0 - (p.y + view_top)) * pixel_size;
         return p;
     }
 private:
-    void initialize();
+    void initialize(Vec2<i32> size, bool draw);
+    // with the workers stopped, after a setter changed how pixels are drawn
+    void redraw();
+    // a queued view change, see resizeCanvas, pan and zoom
+    struct ViewCommand {
+        enum Kind { RESIZE, PAN, ZOOM } kind;
+        Vec2<f64> vector; // the pan delta or the zoom focus
+        f64 amount;       // of the zoom
+        Vec2<i32> size;   // of the resize
+    };
+    void post(const ViewCommand &command);
+    bool applyCommands();
+    void applyResize(Vec2<i32> size);
+    void applyPan(Vec2<f64> delta);
+    void applyZoom(Vec2<f64> focus, f64 amount);
+    void updateFractalSize();
+    void moveCenter(Vec2<f64> delta);
+    void updateView();
     void generateFullWorkUnits();
+    void generateWorkUnits(i32 min_x, i32 max_x, i32 min_y, i32 max_y);
+    void prioritizeWorkUnits();
     struct WorkUnit { i32 min_x, max_x, min_y, max_y; };
+    void splitCostlyUnits();
+    void splitWorkUnit(WorkUnit w, u64 cost, u64 share, std::vector<WorkUnit> &out);
     void startDrawing();
-    void getWorkUnit();
-    void doWorkUnit(WorkUnit w);
-    Color (FractalExplorer::*computePixel)(i32, i32);
-    Color computeMandlebrotPixel(i32 px, i32 py);
-    Color computeJuliaPixel(i32 px, i32 py);
-    Window *window;
+    void submitPass(i32 step);
+    // the pixels unit.min + step * (x, y) of a work unit, for 0 <= x < width, 0 <= y < height
+    struct Tile {
+        WorkUnit unit;
+        i32 step;
+        i32 width, height;
+    };
+    inline i32 fieldIndex(const Tile &t, i32 x, i32 y) {
+        return (t.unit.min_y + y * t.step) * canvas->width + t.unit.min_x + x * t.step;
+    }
+    void doWorkUnit(WorkUnit w, i32 step);
+    void computeRect(Tile &t, i32 min_x, i32 min_y, i32 max_x, i32 max_y, bool border_only);
+    void subdivideTile(Tile &t, i32 min_x, i32 min_y, i32 max_x, i32 max_y);
+    EscapeTimeParams escape_params;
     Buffer *canvas;
+    CanvasDamage damage;
     u32 max_iterations = 1000;
+    bool boundary_tracing = false;
+    bool progressive = true;
+    bool fast_smoothing = true;
+    bool started = false; // a view was drawn, the setters draw it again
+    bool recolor_pending = false; // recolor was asked while a frame was drawing
     std::atomic<bool> stop_drawing = false;
+    std::atomic<f32> palette_offset = 0;
 
     // {-0.835, -0.321}
     f64 zoom_level;
-    Vec2<f64> c, offset, fractal_size;// = 1.15; //to see it all
+    f64 requested_zoom; // the product of the zooms, zoom_level is it snapped
+    f64 pixel_size;
+    Vec2<f64> c, fractal_size;// = 1.15; //to see it all
+    i32 view_height, view_top = 0; // rows of the view and the first one on the canvas
+    Fixed center_x, center_y; // the view center, the origin is derived from it
+    // grid index of the top left pixel of the view, see screenToFractal. taken from the
+    // center by the first frame after a zoom, resize or setView, pans then move it
+    Vec2<i64> origin;
+    bool anchored = false;
 
-    std::vector<WorkUnit> work_units;
-    std::mutex work_unit_lock;
-    std::vector<std::thread> threads;
+    bool deep_zoom = false;
+    ReferenceOrbit reference;
+    SeriesApproximation series;
+    // the view the reference and series belong to. the bands of an image share them,
+    // so they are computed once for all of them
+    struct ReferenceView {
+        Fixed x, y;
+        f64 pixel_size;
+        i32 width, height;
+        u32 max_iterations;
+        bool operator==(const ReferenceView &v) const {
+            return x.precision == v.x.precision && x.mantissa == v.x.mantissa
+                && y.precision == v.y.precision && y.mantissa == v.y.mantissa
+                && pixel_size == v.pixel_size && width == v.width && height == v.height
+                && max_iterations == v.max_iterations;
+        }
+    };
+    ReferenceView reference_view;
+    bool reference_valid = false;
+    std::atomic<u64> skipped_iterations = 0;
+    std::atomic<u64> cached_pixels = 0;
 
-    std::mutex finished_lock;
-    i32 finished = 0;
-    std::condition_variable all_stopped_condition;
+    // escape iteration (NOT_COMPUTED until iterated or filled) and smooth value of every
+    // pixel of the current view, shared by the passes of a frame
+    std::vector<u32> iteration_field;
+    std::vector<f32> smooth_field;
 
-    bool work_available = false;
-    std::mutex work_available_lock;
-    std::condition_variable waiting_condition;
-    std::atomic<bool> alive = true;
-    //std::mutex finished_lock;
+    // filled while the workers are stopped, then handed to the pool pass by pass.
+    // sorted nearest to focus first, every task of a pass takes the next unit in order.
+    // the last task of a pass splits the costly ones before starting the next
+    std::vector<WorkUnit> work_units;
+    Vec2<f64> focus;
+    std::atomic<i32> next_unit = 0;
+    std::vector<u64> unit_costs; // nanoseconds each unit of the pass took, written by its task
+    std::atomic<i32> pass_remaining = 0;
+    std::atomic<bool> frame_complete = false; // the last pass of the view finished uninterrupted
+    Vec2<f64> pan_remainder = {0, 0};         // fraction of a pixel panned but not yet moved
+    std::vector<ViewCommand> commands;        // posted by the owner thread, applied with the workers stopped
+    TileCache cache;
+    ThreadPool &pool = ThreadPool::shared();
+    TaskGroup drawing;
 };
 
 bool writeBitmap(const char *filename, const Buffer buf);
+// a bitmap written band by band, the rows of each band following the previous ones
+FILE *beginBitmap(const char *filename, i32 width, i32 height);
+bool writeBitmapRows(FILE *file, const Buffer &band);
+bool endBitmap(FILE *file);
 
 #endif // mandelbrot_h
@@ -0,0 +1,129 @@
+#include <perturbation.h>
+#include <escape_time.h>
+
+u32 ReferenceOrbit::precisionFor(f64 pixel_size) {
+    // one digit for the integer part, the pixel size and 64 guard bits
+    i32 bits = (i32)std::ceil(-std::log2(pixel_size)) + 64;
+    return max(2, bits / 32 + 1);
+}
+
+bool ReferenceOrbit::compute(const Fixed &cx, const Fixed &cy, u32 max_iterations, f64 bailout,
+                             const std::atomic<bool> *stop) {
+    u32 precision = max(cx.precision, cy.precision);
+    julia = false;
+    return iterate(Fixed(0.0, precision), Fixed(0.0, precision), cx, cy, max_iterations, bailout, stop);
+}
+
+bool ReferenceOrbit::computeJulia(const Fixed &x, const Fixed &y, Vec2<f64> c, u32 max_iterations, f64 bailout,
+                                  const std::atomic<bool> *stop) {
+    u32 precision = max(x.precision, y.precision);
+    julia = true;
+    return iterate(x, y, Fixed(c.x, precision), Fixed(c.y, precision), max_iterations, bailout, stop);
+}
+
+bool ReferenceOrbit::iterate(Fixed zx, Fixed zy, const Fixed &cx, const Fixed &cy, u32 max_iterations, f64 bailout,
+                             const std::atomic<bool> *stop) {
+    z.clear();
+    z.reserve(max_iterations + 1);
+    z.push_back({zx.toDouble(), zy.toDouble()});
+    for (u32 i = 0; i < max_iterations; ++i) {
+        if (i % STOP_POLL_INTERVAL == 0 && stop && stop->load(std::memory_order_relaxed)) return false;
+        Fixed x2 = zx * zx;
+        Fixed y2 = zy * zy;
+        Fixed xy = zx * zy;
+        zy = xy + xy + cy;
+        zx = x2 - y2 + cx;
+        Vec2<f64> v{zx.toDouble(), zy.toDouble()};
+        z.push_back(v);
+        if (v.x * v.x + v.y * v.y > bailout) break;
+    }
+    return true;
+}
+
+void SeriesApproximation::compute(const ReferenceOrbit &orbit, f64 r, const Vec2<f64> *probes, i32 n_probes, u32 max_iterations) {
+    radius = r;
+    skipped = 0;
+    a = b = c = {0.0, 0.0};
+    // a julia dz starts at the offset, dz_0 = 1 dz_0, and no dc is added along the way
+    f64 dc_term = orbit.julia ? 0.0 : radius;
+    if (orbit.julia) a = {radius, 0.0};
+    std::vector<Vec2<f64>> dz(n_probes, {0.0, 0.0});
+    if (orbit.julia) dz.assign(probes, probes + n_probes);
+    // the last orbit entry must stay available for the pixels to continue from
+    usize limit = min((usize)max_iterations, orbit.z.size() - 2);
+    for (usize n = 0; n < limit; ++n) {
+        Vec2<f64> Z = orbit.z[n];
+        // A' = 2 Z A + r,  B' = 2 Z B + A^2,  C' = 2 Z C + 2 A B  (all scaled, A' = 2 Z A for julia)
+        Vec2<f64> na{2.0 * (Z.x * a.x - Z.y * a.y) + dc_term, 2.0 * (Z.x * a.y + Z.y * a.x)};
+        Vec2<f64> nb{2.0 * (Z.x * b.x - Z.y * b.y) + a.x * a.x - a.y * a.y,
+                     2.0 * (Z.x * b.y + Z.y * b.x) + 2.0 * a.x * a.y};
+        Vec2<f64> nc{2.0 * (Z.x * c.x - Z.y * c.y) + 2.0 * (a.x * b.x - a.y * b.y),
+                     2.0 * (Z.x * c.y + Z.y * c.x) + 2.0 * (a.x * b.y + a.y * b.x)};
+        if (lengthSquared(nc) > sqr(TERM_TOLERANCE) * lengthSquared(na)) return;
+
+        SeriesApproximation next = *this;
+        next.a = na; next.b = nb; next.c = nc;
+        const Vec2<f64> &Z1 = orbit.z[n + 1];
+        for (i32 i = 0; i < n_probes; ++i) {
+            Vec2<f64> d = dz[i], offset = probes[i];
+            Vec2<f64> dc = orbit.julia ? Vec2<f64>{0.0, 0.0} : offset;
+            d = {2.0 * (Z.x * d.x - Z.y * d.y) + d.x * d.x - d.y * d.y + dc.x,
+                 2.0 * (Z.x * d.y + Z.y * d.x) + 2.0 * d.x * d.y + dc.y};
+            Vec2<f64> z = Z1 + d;
+            if (lengthSquared(z) < lengthSquared(d)) return;
+            Vec2<f64> error = next.evaluate(offset.x, offset.y) - d;
+            if (lengthSquared(error) > sqr(PROBE_TOLERANCE) * lengthSquared(d)) return;
+            dz[i] = d;
+        }
+        a = na; b = nb; c = nc;
+        skipped = n + 1;
+    }
+}
+
+i32 perturbationEscapeTime(const ReferenceOrbit &orbit, const SeriesApproximation *series,
+                           const f64 *dx, const f64 *dy, i32 n,
+                           u32 max_iterations, f64 bailout, u32 *iterations, f64 *magnitudes,
+                           const std::atomic<bool> *stop) {
+    const Vec2<f64> *Z = orbit.z.data();
+    usize last = orbit.z.size() - 1;
+    for (i32 i = 0; i < n; ++i) {
+        f64 dcx = orbit.julia ? 0.0 : dx[i], dcy = orbit.julia ? 0.0 : dy[i];
+        f64 dzx = orbit.julia ? dx[i] : 0.0, dzy = orbit.julia ? dy[i] : 0.0;
+        f64 magnitude = 0.0;
+        usize m = 0;
+        u32 iteration = 0;
+        if (series && series->skipped) {
+            Vec2<f64> dz = series->evaluate(dx[i], dy[i]);
+            dzx = dz.x;
+            dzy = dz.y;
+            m = iteration = series->skipped;
+        }
+        u32 poll = iteration + STOP_POLL_INTERVAL;
+        while (iteration < max_iterations) {
+            if (iteration == poll) {
+                if (stop && stop->load(std::memory_order_relaxed)) return i;
+                poll += STOP_POLL_INTERVAL;
+            }
+            f64 zx = Z[m].x, zy = Z[m].y;
+            f64 new_dzx = 2.0 * (zx * dzx - zy * dzy) + dzx * dzx - dzy * dzy + dcx;
+            f64 new_dzy = 2.0 * (zx * dzy + zy * dzx) + 2.0 * dzx * dzy + dcy;
+            dzx = new_dzx;
+            dzy = new_dzy;
+            ++m;
+            ++iteration;
+
+            zx = Z[m].x + dzx;
+            zy = Z[m].y + dzy;
+            magnitude = zx * zx + zy * zy;
+            if (magnitude > bailout) break;
+            if (magnitude < dzx * dzx + dzy * dzy || m == last) {
+                dzx = zx - Z[0].x;
+                dzy = zy - Z[0].y;
+                m = 0;
+            }
+        }
+        iterations[i] = iteration;
+        magnitudes[i] = magnitude;
+    }
+    return n;
+}
@@ -0,0 +1,69 @@
+#ifndef perturbation_h
+#define perturbation_h
+
+#include <extramath.h>
+#include <atomic>
+
+// deep zoom by perturbation: a single reference orbit Z_n is iterated in fixed point
+// at the view center, every pixel then iterates only its f64 offset from it,
+//     dz_{n+1} = 2 Z_n dz_n + dz_n^2 + dc,
+// which stays accurate as long as dz is small compared to the full z = Z_n + dz_n.
+// for the mandelbrot set dc is the offset of the pixel and dz_0 = 0. for a julia set
+// c is the same for all, so dc = 0 and the offset is dz_0 instead.
+
+struct ReferenceOrbit {
+    // fraction digits needed to resolve pixels of the given size
+    static u32 precisionFor(f64 pixel_size);
+    // the mandelbrot orbit of c = (cx, cy). returns false if stop was raised, the orbit
+    // is then cut short
+    bool compute(const Fixed &cx, const Fixed &cy, u32 max_iterations, f64 bailout,
+                 const std::atomic<bool> *stop = nullptr);
+    // the orbit of the julia set of c starting at Z_0 = (x, y), stop as above
+    bool computeJulia(const Fixed &x, const Fixed &y, Vec2<f64> c, u32 max_iterations, f64 bailout,
+                      const std::atomic<bool> *stop = nullptr);
+    bool julia = false;
+    std::vector<Vec2<f64>> z; // Z_0 .. up to the escape of the reference or max_iterations
+private:
+    bool iterate(Fixed zx, Fixed zy, const Fixed &cx, const Fixed &cy, u32 max_iterations, f64 bailout,
+                 const std::atomic<bool> *stop);
+};
+
+// series approximation: for the first iterations every dz of the view is well described by
+//     dz_n = A_n dc + B_n dc^2 + C_n dc^3,
+// with coefficients that only depend on the reference orbit, dc standing for dz_0 in a
+// julia set. the pixels can then start
+// at iteration `skipped` instead of 0.
+// the coefficients are kept scaled by powers of the view radius (A_n r, B_n r^2, C_n r^3)
+// so they stay inside f64 range at any depth.
+struct SeriesApproximation {
+    // radius bounds |dc| over the view. probes are offsets, usually the corners of the view,
+    // whose exact perturbed orbit checks the approximation at every step.
+    // the series stops at the first iteration where the cubic term is no longer negligible,
+    // where a probe disagrees by more than the tolerance, or where a probe would need a rebase.
+    void compute(const ReferenceOrbit &orbit, f64 radius, const Vec2<f64> *probes, i32 n_probes, u32 max_iterations);
+    inline Vec2<f64> evaluate(f64 dcx, f64 dcy) const {
+        f64 ux = dcx / radius, uy = dcy / radius;
+        // horner in u: ((C u + B) u + A) u
+        f64 rx = c.x * ux - c.y * uy + b.x, ry = c.x * uy + c.y * ux + b.y;
+        f64 tx = rx * ux - ry * uy + a.x, ty = rx * uy + ry * ux + a.y;
+        return { tx * ux - ty * uy, tx * uy + ty * ux };
+    }
+    static constexpr f64 TERM_TOLERANCE = 1e-12;  // |C_n| r^3 against |A_n| r
+    static constexpr f64 PROBE_TOLERANCE = 1e-9;  // relative error of a probe's dz
+    u32 skipped = 0;
+    f64 radius = 1.0;
+    Vec2<f64> a, b, c;
+};
+
+// dx, dy hold the n pixel offsets from the reference point, dc or dz_0 by the orbit;
+// the outputs match escapeTime.
+// a pixel whose |z| drops below its |dz| is about to lose its significant digits (a glitch);
+// it is rebased onto the start of the orbit with dz = z - Z_0, as is any pixel that
+// outlives the reference orbit. with a series, iteration starts at series->skipped.
+// stop and the returned count work as for escapeTime
+i32 perturbationEscapeTime(const ReferenceOrbit &orbit, const SeriesApproximation *series,
+                           const f64 *dx, const f64 *dy, i32 n,
+                           u32 max_iterations, f64 bailout, u32 *iterations, f64 *magnitudes,
+                           const std::atomic<bool> *stop = nullptr);
+
+#endif // perturbation_h
@@ -0,0 +1,235 @@
+#include <mandelbrot.h>
+#include <window.h>
+#include <field_file.h>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+
+// fex-render: draws one view without a window and writes it to a bitmap.
+// the image is drawn in bands of full rows streamed to the file one after the other,
+// so memory is bounded by the band whatever the size of the image.
+// the smoothed iteration counts can be saved as well, and colored again later
+// with another palette without iterating. in deep zoom it reports the iterations
+// the series approximation skipped in each band.
+
+static constexpr i64 BAND_PIXELS = 1 << 24; // default band size, about 200 MiB of canvas and fields
+
+// rows of a band, the given ones or BAND_PIXELS worth. the buffers and the explorer count
+// the pixels of a band in i32, so a band holds at most INT32_MAX of them
+static i32 bandRows(i32 band_rows, i32 width, i32 height) {
+    if (band_rows == 0) band_rows = max<i64>(1, BAND_PIXELS / width);
+    return min(min(band_rows, INT32_MAX / width), height);
+}
+
+static void usage() {
+    fprintf(stderr,
+        "usage: fex-render [options] output.bmp\n"
+        "       fex-render --recolor input.field [--hue H] [--band-rows N] output.bmp\n"
+        "  --size WxH            image size in pixels (1920x1080)\n"
+        "  --center X,Y          view center, decimals of any length (0,0)\n"
+        "  --zoom Z              magnification, at 1 the shorter side spans [-2, 2] (1)\n"
+        "  --iterations N        iteration limit (1000)\n"
+        "  --julia CX,CY         the julia set of c instead of the mandelbrot set\n"
+        "  --boundary-tracing    fill uniform rectangles instead of iterating them,\n"
+        "                        faster but a few pixels may be wrong\n"
+        "  --exact-smoothing     smooth the escape counts with f64 logarithms\n"
+        "  --band-rows N         rows drawn at a time (16M pixels worth)\n"
+        "  --field FILE          also save the smoothed iteration counts,\n"
+        "                        for centers of up to 1023 characters\n"
+        "  --recolor FILE        color saved iteration counts instead of drawing\n"
+        "  --hue H               single hue palette, H in [0, 1)\n");
+}
+
+// colors the mapped iteration counts band by band
+static bool recolor(const MappedField &field, const char *output, i32 band_rows) {
+    const FieldHeader &h = *field.header;
+    FILE *file = beginBitmap(output, h.width, h.height);
+    if (!file) return false;
+    band_rows = bandRows(band_rows, h.width, h.height);
+    Buffer *band = initBuffer(h.width, band_rows);
+    bool written = true;
+    for (i32 top = 0; top < h.height && written; top += band_rows) {
+        Buffer rows = {band->data, h.width, min(band_rows, h.height - top)};
+        const f32 *smooth = field.data + (u64)top * h.width;
+        ThreadPool::shared().parallelFor(0, rows.height, 16, [&](i32 first, i32 last) {
+            usize begin = (usize)first * rows.width;
+            colorField(smooth + begin, (usize)(last - first) * rows.width, h.max_iterations, 0, rows.data + begin);
+        });
+        written = writeBitmapRows(file, rows);
+    }
+    freeBuffer(band);
+    delete band;
+    return endBitmap(file) && written;
+}
+
+// "a<separator>b"
+static bool splitPair(const char *arg, char separator, std::string &a, std::string &b) {
+    const char *split = strchr(arg, separator);
+    if (!split || split == arg || !split[1]) return false;
+    a.assign(arg, split);
+    b.assign(split + 1);
+    return true;
+}
+
+int main(int argc, char **argv) {
+    Vec2<i32> size = {1920, 1080};
+    std::string center_x = "0", center_y = "0";
+    f64 zoom = 1.0;
+    u32 iterations = 1000;
+    i32 band_rows = 0;
+    bool julia = false, boundary_tracing = false, exact_smoothing = false;
+    Vec2<f64> julia_param = {0, 0};
+    const char *output = nullptr;
+    const char *field_output = nullptr;
+    const char *recolor_input = nullptr;
+    f32 hue = -1;
+
+    for (i32 i = 1; i < argc; ++i) {
+        std::string a, b;
+        bool has_value = i + 1 < argc;
+        if (!strcmp(argv[i], "--size") && has_value && splitPair(argv[i + 1], 'x', a, b)) {
+            size = {atoi(a.c_str()), atoi(b.c_str())};
+            ++i;
+        } else if (!strcmp(argv[i], "--center") && has_value && splitPair(argv[i + 1], ',', a, b)) {
+            center_x = a;
+            center_y = b;
+            ++i;
+        } else if (!strcmp(argv[i], "--zoom") && has_value) {
+            zoom = strtod(argv[++i], nullptr);
+        } else if (!strcmp(argv[i], "--iterations") && has_value) {
+            iterations = strtoul(argv[++i], nullptr, 10);
+        } else if (!strcmp(argv[i], "--julia") && has_value && splitPair(argv[i + 1], ',', a, b)) {
+            julia = true;
+            julia_param = {strtod(a.c_str(), nullptr), strtod(b.c_str(), nullptr)};
+            ++i;
+        } else if (!strcmp(argv[i], "--band-rows") && has_value) {
+            band_rows = atoi(argv[++i]);
+            if (band_rows <= 0) {
+                usage();
+                return EXIT_FAILURE;
+            }
+        } else if (!strcmp(argv[i], "--field") && has_value) {
+            field_output = argv[++i];
+        } else if (!strcmp(argv[i], "--recolor") && has_value) {
+            recolor_input = argv[++i];
+        } else if (!strcmp(argv[i], "--hue") && has_value) {
+            hue = strtof(argv[++i], nullptr);
+        } else if (!strcmp(argv[i], "--boundary-tracing")) {
+            boundary_tracing = true;
+        } else if (!strcmp(argv[i], "--exact-smoothing")) {
+            exact_smoothing = true;
+        } else if (argv[i][0] != '-' && !output) {
+            output = argv[i];
+        } else {
+            usage();
+            return EXIT_FAILURE;
+        }
+    }
+    if (!output || size.x <= 0 || size.y <= 0 || !(zoom > 0) || iterations == 0) {
+        usage();
+        return EXIT_FAILURE;
+    }
+
+    if (hue >= 0) {
+        generatePaletteMonochrome(hue);
+    } else {
+        generatePalette();
+    }
+    setPaletteBlending(true);
+
+    if (recolor_input) {
+        MappedField field;
+        if (!mapField(recolor_input, field)) {
+            fprintf(stderr, "fex-render: %s is not a field file\n", recolor_input);
+            return EXIT_FAILURE;
+        }
+        bool written = recolor(field, output, band_rows);
+        unmapField(field);
+        if (!written) {
+            fprintf(stderr, "fex-render: cannot write %s\n", output);
+            return EXIT_FAILURE;
+        }
+        return EXIT_SUCCESS;
+    }
+
+    band_rows = bandRows(band_rows, size.x, size.y);
+
+    // enough fraction digits for the pixels, one more for the digits of the center
+    f64 pixel_size = 4.0 / zoom / min(size.x, size.y);
+    u32 precision = ReferenceOrbit::precisionFor(pixel_size) + 1;
+    Fixed x, y;
+    try {
+        x = Fixed(center_x, precision);
+        y = Fixed(center_y, precision);
+    } catch (const std::invalid_argument &) {
+        fprintf(stderr, "fex-render: invalid center %s,%s\n", center_x.c_str(), center_y.c_str());
+        return EXIT_FAILURE;
+    }
+
+    // the field header keeps the center as given, a longer one would record another view
+    if (field_output && (center_x.size() >= sizeof(FieldHeader::center_x) || center_y.size() >= sizeof(FieldHeader::center_y))) {
+        fprintf(stderr, "fex-render: a field file records centers of up to %zu characters\n", sizeof(FieldHeader::center_x) - 1);
+        return EXIT_FAILURE;
+    }
+
+    FILE *file = beginBitmap(output, size.x, size.y);
+    if (!file) {
+        fprintf(stderr, "fex-render: cannot write %s\n", output);
+        return EXIT_FAILURE;
+    }
+    FILE *field_file = nullptr;
+    if (field_output) {
+        FieldHeader header = {};
+        header.width = size.x;
+        header.height = size.y;
+        header.max_iterations = iterations;
+        header.julia = julia;
+        header.julia_c[0] = julia_param.x;
+        header.julia_c[1] = julia_param.y;
+        header.zoom = zoom;
+        strncpy(header.center_x, center_x.c_str(), sizeof(header.center_x) - 1);
+        strncpy(header.center_y, center_y.c_str(), sizeof(header.center_y) - 1);
+        field_file = beginField(field_output, header);
+        if (!field_file) {
+            fprintf(stderr, "fex-render: cannot write %s\n", field_output);
+            endBitmap(file);
+            return EXIT_FAILURE;
+        }
+    }
+
+    // one explorer draws every band, so a deep zoom computes its reference once.
+    // it is set up without drawing, setView starts the band
+    FractalExplorer *f = julia ? new FractalExplorer({size.x, band_rows}, julia_param, false)
+                               : new FractalExplorer({size.x, band_rows}, false);
+    f->setProgressive(false);
+    f->setBoundaryTracing(boundary_tracing);
+    f->setFastSmoothing(!exact_smoothing);
+    f->setCacheBudget(0);
+    f->setMaxIterations(iterations);
+    bool written = true;
+    for (i32 top = 0; top < size.y && written; top += band_rows) {
+        // the band is a window on the whole image, so every band takes the same path and reference.
+        // the last one may be shorter than the canvas
+        Buffer band = {f->getCanvas()->data, size.x, min(band_rows, size.y - top)};
+        f->setView(x, y, zoom, size.y, top);
+        f->waitDrawing();
+        if (u64 skipped = f->skippedIterations()) {
+            printf("rows %d-%d: the series approximation skipped %llu iterations\n",
+                   top, top + band.height - 1, (unsigned long long)skipped);
+        }
+        written = writeBitmapRows(file, band);
+        if (field_file && written) {
+            written = writeFieldRows(field_file, f->getSmoothField(), band.width, band.height);
+        }
+    }
+    delete f;
+
+    if (field_file && !endField(field_file)) written = false;
+    if (!endBitmap(file) || !written) {
+        fprintf(stderr, "fex-render: cannot write %s\n", output);
+        return EXIT_FAILURE;
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,21 @@
+#!/bin/sh
+# a render drawn in bands must equal the same render drawn in one band,
+# in f64, in deep zoom and for a julia set, also in deep zoom. boundary tracing fills by
+# tile and is left out
+set -e
+render=$1
+dir=$(mktemp -d)
+trap 'rm -rf "$dir"' EXIT
+
+check() {
+    "$render" --size 400x300 "$@" --field "$dir/single.field" "$dir/single.bmp"
+    "$render" --size 400x300 "$@" --band-rows 37 --field "$dir/banded.field" "$dir/banded.bmp"
+    cmp "$dir/single.bmp" "$dir/banded.bmp"
+    cmp "$dir/single.field" "$dir/banded.field"
+}
+
+check --center -0.75,0.1 --zoom 20
+check --center -0.743643887037158704752191506114774,0.131825904205311970493132056385139 --zoom 5e10 --iterations 3000
+check --center -1.25,0 --zoom 3e13 --iterations 2000
+check --julia -0.8,0.156 --zoom 2
+check --julia -0.8,0.156 --center 0.117744,0.1 --zoom 1e15 --iterations 5000
@@ -0,0 +1,120 @@
+#include <mandelbrot.h>
+#include <cstdio>
+#include <cstdlib>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// views drawn by the explorer after pans and zooms, against the same views drawn in
+// full or before. the smoothed counts are compared bit for bit
+
+static const Vec2<i32> SIZE = {320, 240};
+
+static std::vector<f32> field(FractalExplorer &f) {
+    f.waitDrawing();
+    const f32 *smooth = f.getSmoothField();
+    return std::vector<f32>(smooth, smooth + SIZE.x * SIZE.y);
+}
+
+static bool check(bool ok, const char *what) {
+    if (!ok) fprintf(stderr, "explorer_test: %s\n", what);
+    return ok;
+}
+
+static void setView(FractalExplorer &f, const char *x, const char *y, f64 zoom) {
+    u32 precision = ReferenceOrbit::precisionFor(4.0 / zoom / min(SIZE.x, SIZE.y)) + 1;
+    f.setView(Fixed(x, precision), Fixed(y, precision), zoom);
+}
+
+// the pixels kept by a pan and the exposed ones are those of a full redraw
+static bool panMatchesRedraw() {
+    FractalExplorer f{SIZE};
+    f.setProgressive(false);
+    f.setCacheBudget(0);
+    setView(f, "-0.7435669", "0.1314023", 300);
+    std::vector<f32> before = field(f);
+    f.pan({37, -23});
+    f.pan({-5.5, 2.25});
+    std::vector<f32> panned = field(f);
+    f.setMaxIterations(f.getMaxIterations()); // draws the same view again, all of it
+    bool ok = check(panned == field(f), "a panned view differs from its full redraw");
+    f.pan({-31.5, 20.75});
+    return check(field(f) == before, "panning back does not give the view it left") && ok;
+}
+
+// returning to a view takes its pixels from the tile cache, and they are the ones it had
+static bool returnHitsCache() {
+    FractalExplorer f{SIZE};
+    f.setProgressive(false);
+    f.setCacheBudget(64 << 20);
+    setView(f, "-0.7435669", "0.1314023", 256); // a zoom step, see FractalExplorer::ZOOM_STEPS
+    std::vector<f32> before = field(f);
+    bool ok = check(f.cachedPixels() == 0, "a new view is taken from the cache");
+
+    f.pan({37, -23});
+    field(f);
+    f.pan({-37, 23});
+    u64 exposed = SIZE.x * SIZE.y - (SIZE.x - 37) * (SIZE.y - 23);
+    ok = check(field(f) == before, "panning back through the cache changes the view") && ok;
+    ok = check(f.cachedPixels() == exposed, "panning back computes the exposed pixels again") && ok;
+
+    Vec2<f64> focus = {100, 70};
+    f.zoom(focus, 1.3);
+    field(f);
+    f.zoom(focus, 1 / 1.3);
+    ok = check(field(f) == before, "zooming back through the cache changes the view") && ok;
+    ok = check(f.cachedPixels() == (u64)(SIZE.x * SIZE.y), "zooming back computes the view again") && ok;
+    return ok;
+}
+
+// switching the smoothing draws the view again, none of it from counts cached with the other one
+static bool smoothingKeepsCacheApart() {
+    FractalExplorer f{SIZE};
+    f.setProgressive(false);
+    f.setCacheBudget(64 << 20);
+    setView(f, "-0.7435669", "0.1314023", 256);
+    field(f);
+    f.setFastSmoothing(false);
+    std::vector<f32> exact = field(f);
+    bool ok = check(f.cachedPixels() == 0, "exact smoothing takes counts cached with the fast one");
+
+    FractalExplorer g{SIZE};
+    g.setProgressive(false);
+    g.setCacheBudget(0);
+    g.setFastSmoothing(false);
+    setView(g, "-0.7435669", "0.1314023", 256);
+    return check(exact == field(g), "switching the smoothing mixes the two") && ok;
+}
+
+// a recolor asked while the frame draws reaches the pixels drawn before it once the frame completes
+static bool recolorWhileDrawing() {
+    FractalExplorer f{SIZE};
+    f.setCacheBudget(0);
+    setView(f, "-0.7435669", "0.1314023", 256);
+    f.setMaxIterations(20000);
+    auto start = std::chrono::steady_clock::now();
+    f.waitDrawing();
+    auto frame = std::chrono::steady_clock::now() - start;
+    // the same frame again, the palette changing once the last pass finished part of the view
+    f.setMaxIterations(20001);
+    std::this_thread::sleep_for(frame * 6 / 10);
+    generatePaletteMonochrome(0.3);
+    f.recolor();
+    std::vector<f32> smooth = field(f);
+    std::vector<u32> colors(smooth.size());
+    colorField(smooth.data(), smooth.size(), f.getMaxIterations(), 0, colors.data());
+    const u32 *canvas = f.getCanvas()->data;
+    bool ok = check(std::equal(colors.begin(), colors.end(), canvas), "pixels drawn before a recolor keep the old palette");
+    generatePalette();
+    return ok;
+}
+
+int main() {
+    generatePalette();
+    bool ok = panMatchesRedraw();
+    ok = returnHitsCache() && ok;
+    ok = smoothingKeepsCacheApart() && ok;
+    ok = recolorWhileDrawing() && ok;
+    return ok ? EXIT_SUCCESS : EXIT_FAILURE;
+}
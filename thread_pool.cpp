@@ -0,0 +1,334 @@
+#include <thread_pool.h>
+#include <algorithm>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#include <dirent.h>
+#endif
+
+struct PoolTask {
+    std::function<void()> f;
+    TaskGroup *group;
+};
+
+static thread_local ThreadPool *current_pool = nullptr;
+static thread_local i32 current_worker = -1;
+
+WorkStealingDeque::WorkStealingDeque() : top(0), bottom(0) {
+    Array *a = new Array{256, new std::atomic<PoolTask *>[256]};
+    array.store(a, std::memory_order_relaxed);
+}
+
+WorkStealingDeque::~WorkStealingDeque() {
+    Array *a = array.load(std::memory_order_relaxed);
+    for (i64 i = top.load(std::memory_order_relaxed); i < bottom.load(std::memory_order_relaxed); ++i) {
+        delete a->get(i);
+    }
+    retired.push_back(a);
+    for (Array *r : retired) {
+        delete[] r->slots;
+        delete r;
+    }
+}
+
+void WorkStealingDeque::push(PoolTask *task) {
+    i64 b = bottom.load(std::memory_order_relaxed);
+    i64 t = top.load(std::memory_order_acquire);
+    Array *a = array.load(std::memory_order_relaxed);
+    if (b - t > a->capacity - 1) {
+        Array *grown = new Array{a->capacity * 2, new std::atomic<PoolTask *>[a->capacity * 2]};
+        for (i64 i = t; i < b; ++i) grown->put(i, a->get(i));
+        retired.push_back(a);
+        array.store(grown, std::memory_order_release);
+        a = grown;
+    }
+    a->put(b, task);
+    std::atomic_thread_fence(std::memory_order_release);
+    bottom.store(b + 1, std::memory_order_relaxed);
+}
+
+PoolTask *WorkStealingDeque::pop() {
+    i64 b = bottom.load(std::memory_order_relaxed) - 1;
+    Array *a = array.load(std::memory_order_relaxed);
+    bottom.store(b, std::memory_order_relaxed);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    i64 t = top.load(std::memory_order_relaxed);
+    if (t > b) {
+        bottom.store(b + 1, std::memory_order_relaxed);
+        return nullptr;
+    }
+    PoolTask *task = a->get(b);
+    if (t == b) {
+        // last element, race the thieves for it
+        if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+            task = nullptr;
+        }
+        bottom.store(b + 1, std::memory_order_relaxed);
+    }
+    return task;
+}
+
+PoolTask *WorkStealingDeque::steal() {
+    i64 t = top.load(std::memory_order_acquire);
+    std::atomic_thread_fence(std::memory_order_seq_cst);
+    i64 b = bottom.load(std::memory_order_acquire);
+    if (t >= b) return nullptr;
+    Array *a = array.load(std::memory_order_acquire);
+    PoolTask *task = a->get(t);
+    if (!top.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed)) {
+        return nullptr;
+    }
+    return task;
+}
+
+InjectionQueue::InjectionQueue(u64 capacity) : cells(new Cell[capacity]), mask(capacity - 1) {
+    assert((capacity & mask) == 0);
+    for (u64 i = 0; i < capacity; ++i) cells[i].sequence.store(i, std::memory_order_relaxed);
+    enqueue_pos.store(0, std::memory_order_relaxed);
+    dequeue_pos.store(0, std::memory_order_relaxed);
+}
+
+InjectionQueue::~InjectionQueue() {
+    while (PoolTask *task = pop()) delete task;
+    delete[] cells;
+}
+
+bool InjectionQueue::push(PoolTask *task) {
+    u64 pos = enqueue_pos.load(std::memory_order_relaxed);
+    Cell *cell;
+    for (;;) {
+        cell = &cells[pos & mask];
+        i64 dif = (i64)cell->sequence.load(std::memory_order_acquire) - (i64)pos;
+        if (dif == 0) {
+            if (enqueue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        } else if (dif < 0) {
+            return false;
+        } else {
+            pos = enqueue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    cell->task = task;
+    cell->sequence.store(pos + 1, std::memory_order_release);
+    return true;
+}
+
+PoolTask *InjectionQueue::pop() {
+    u64 pos = dequeue_pos.load(std::memory_order_relaxed);
+    Cell *cell;
+    for (;;) {
+        cell = &cells[pos & mask];
+        i64 dif = (i64)cell->sequence.load(std::memory_order_acquire) - (i64)(pos + 1);
+        if (dif == 0) {
+            if (dequeue_pos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed)) break;
+        } else if (dif < 0) {
+            return nullptr;
+        } else {
+            pos = dequeue_pos.load(std::memory_order_relaxed);
+        }
+    }
+    PoolTask *task = cell->task;
+    cell->sequence.store(pos + mask + 1, std::memory_order_release);
+    return task;
+}
+
+struct CpuInfo {
+    i32 cpu, node, l3, core, sibling;
+};
+
+#ifdef __linux__
+static i32 readSysInt(const char *format, i32 cpu, i32 fallback) {
+    char path[128];
+    std::snprintf(path, sizeof(path), format, cpu);
+    FILE *f = std::fopen(path, "r");
+    if (!f) return fallback;
+    i32 value;
+    if (std::fscanf(f, "%d", &value) != 1) value = fallback;
+    std::fclose(f);
+    return value;
+}
+
+static i32 readCpuNode(i32 cpu) {
+    char path[64];
+    std::snprintf(path, sizeof(path), "/sys/devices/system/cpu/cpu%d", cpu);
+    DIR *dir = opendir(path);
+    if (!dir) return 0;
+    i32 node = 0;
+    while (dirent *entry = readdir(dir)) {
+        if (std::sscanf(entry->d_name, "node%d", &node) == 1) break;
+    }
+    closedir(dir);
+    return node;
+}
+#endif
+
+// the cpus of the affinity mask, in the order workers should be placed on them
+static std::vector<CpuInfo> readTopology() {
+    std::vector<CpuInfo> cpus;
+#ifdef __linux__
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) != 0) return cpus;
+    for (i32 cpu = 0; cpu < CPU_SETSIZE; ++cpu) {
+        if (!CPU_ISSET(cpu, &set)) continue;
+        i32 package = readSysInt("/sys/devices/system/cpu/cpu%d/topology/physical_package_id", cpu, 0);
+        CpuInfo info;
+        info.cpu = cpu;
+        info.node = readCpuNode(cpu);
+        info.l3 = readSysInt("/sys/devices/system/cpu/cpu%d/cache/index3/id", cpu, package);
+        info.core = package * 65536 + readSysInt("/sys/devices/system/cpu/cpu%d/topology/core_id", cpu, cpu);
+        info.sibling = 0;
+        for (const CpuInfo &other : cpus) info.sibling += other.core == info.core;
+        cpus.push_back(info);
+    }
+    std::stable_sort(cpus.begin(), cpus.end(), [](const CpuInfo &a, const CpuInfo &b) {
+        if (a.sibling != b.sibling) return a.sibling < b.sibling;
+        if (a.node != b.node) return a.node < b.node;
+        if (a.l3 != b.l3) return a.l3 < b.l3;
+        return a.core < b.core;
+    });
+#endif
+    return cpus;
+}
+
+u32 ThreadPool::defaultThreadCount() {
+    if (const char *env = std::getenv("FEX_THREADS")) {
+        i32 n = std::atoi(env);
+        if (n > 0) return n;
+    }
+#ifdef __linux__
+    cpu_set_t set;
+    if (sched_getaffinity(0, sizeof(set), &set) == 0 && CPU_COUNT(&set) > 0) return CPU_COUNT(&set);
+#endif
+    return max(1u, std::thread::hardware_concurrency());
+}
+
+ThreadPool::ThreadPool(u32 n_threads, bool pin) : injection(INJECTION_CAPACITY) {
+    n_threads = max(1u, n_threads);
+    std::vector<CpuInfo> cpus;
+    if (pin) cpus = readTopology();
+
+    for (u32 i = 0; i < n_threads; ++i) {
+        deques.push_back(new WorkStealingDeque);
+        victims.emplace_back();
+        for (u32 j = 1; j < n_threads; ++j) victims[i].push_back((i + j) % n_threads);
+    }
+    if (!cpus.empty()) {
+        auto placement = [&](u32 worker) { return cpus[worker % cpus.size()]; };
+        for (u32 i = 0; i < n_threads; ++i) {
+            CpuInfo self = placement(i);
+            std::stable_sort(victims[i].begin(), victims[i].end(), [&](u32 a, u32 b) {
+                CpuInfo ca = placement(a), cb = placement(b);
+                i32 da = (ca.l3 != self.l3) + (ca.node != self.node);
+                i32 db = (cb.l3 != self.l3) + (cb.node != self.node);
+                return da < db;
+            });
+        }
+    }
+
+    for (u32 i = 0; i < n_threads; ++i) {
+        workers.emplace_back(&ThreadPool::workerLoop, this, i);
+#ifdef __linux__
+        if (!cpus.empty()) {
+            cpu_set_t set;
+            CPU_ZERO(&set);
+            CPU_SET(cpus[i % cpus.size()].cpu, &set);
+            pthread_setaffinity_np(workers[i].native_handle(), sizeof(set), &set);
+        }
+#endif
+    }
+}
+
+ThreadPool::~ThreadPool() {
+    alive = false;
+    wake();
+    for (auto &th : workers) th.join();
+    for (WorkStealingDeque *d : deques) delete d;
+}
+
+ThreadPool &ThreadPool::shared() {
+    static ThreadPool pool{defaultThreadCount(), std::getenv("FEX_PIN_THREADS") && std::atoi(std::getenv("FEX_PIN_THREADS")) != 0};
+    return pool;
+}
+
+void ThreadPool::submit(std::function<void()> f, TaskGroup *group) {
+    PoolTask *task = new PoolTask{std::move(f), group};
+    if (group) group->pending.fetch_add(1);
+    if (current_pool == this) {
+        deques[current_worker]->push(task);
+    } else {
+        // a full queue drains as fast as the workers run, help them meanwhile
+        while (!injection.push(task)) {
+            PoolTask *other = findTask(-1);
+            if (other) run(other);
+            else std::this_thread::yield();
+        }
+    }
+    epoch.fetch_add(1);
+    if (sleepers.load() > 0) wake();
+}
+
+void ThreadPool::wake() {
+    std::lock_guard<std::mutex> lock(sleep_lock);
+    sleep_condition.notify_all();
+}
+
+PoolTask *ThreadPool::findTask(i32 self) {
+    if (self >= 0) {
+        if (PoolTask *task = deques[self]->pop()) return task;
+    }
+    if (PoolTask *task = injection.pop()) return task;
+    if (self >= 0) {
+        for (u32 victim : victims[self]) {
+            if (PoolTask *task = deques[victim]->steal()) return task;
+        }
+    } else {
+        for (WorkStealingDeque *d : deques) {
+            if (PoolTask *task = d->steal()) return task;
+        }
+    }
+    return nullptr;
+}
+
+void ThreadPool::run(PoolTask *task) {
+    task->f();
+    TaskGroup *group = task->group;
+    delete task;
+    if (group) group->pending.fetch_sub(1);
+}
+
+void ThreadPool::wait(TaskGroup &group) {
+    i32 self = current_pool == this ? current_worker : -1;
+    u32 idle = 0;
+    while (!group.done()) {
+        PoolTask *task = findTask(self);
+        if (task) {
+            run(task);
+            idle = 0;
+        } else if (++idle < 64) {
+            std::this_thread::yield();
+        } else {
+            // the last tasks of the group are running elsewhere
+            std::this_thread::sleep_for(std::chrono::microseconds(50));
+        }
+    }
+}
+
+void ThreadPool::workerLoop(u32 index) {
+    current_pool = this;
+    current_worker = index;
+    while (alive) {
+        u64 seen = epoch.load();
+        PoolTask *task = findTask(index);
+        if (task) {
+            run(task);
+            continue;
+        }
+        std::unique_lock<std::mutex> lock(sleep_lock);
+        sleepers.fetch_add(1);
+        sleep_condition.wait(lock, [&] { return !alive || epoch.load() != seen; });
+        sleepers.fetch_sub(1);
+    }
+}
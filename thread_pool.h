@@ -0,0 +1,115 @@
+#ifndef thread_pool_h
+#define thread_pool_h
+
+#include <extramath.h>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+#include <mutex>
+#include <thread>
+
+// work stealing scheduler.
+// every worker owns a chase-lev deque: it pushes and pops its own end without locks
+// while idle workers steal from the other end. tasks submitted from outside the pool
+// go through a lock-free bounded queue that workers drain before stealing.
+// the only lock is taken to put idle workers to sleep and to wake them up.
+
+struct PoolTask;
+
+// counts the unfinished tasks submitted with it, so a caller can wait for a batch
+class TaskGroup {
+public:
+    bool done() const { return pending.load() == 0; }
+private:
+    friend class ThreadPool;
+    std::atomic<i64> pending{0};
+};
+
+// single owner deque from "correct and efficient work-stealing for weak memory models", lê et al.
+class WorkStealingDeque {
+public:
+    WorkStealingDeque();
+    ~WorkStealingDeque();
+    void push(PoolTask *task); // owner only
+    PoolTask *pop();           // owner only
+    PoolTask *steal();         // any thread
+private:
+    struct Array {
+        i64 capacity;
+        std::atomic<PoolTask *> *slots;
+        PoolTask *get(i64 i) { return slots[i & (capacity - 1)].load(std::memory_order_relaxed); }
+        void put(i64 i, PoolTask *t) { slots[i & (capacity - 1)].store(t, std::memory_order_relaxed); }
+    };
+    alignas(64) std::atomic<i64> top;
+    alignas(64) std::atomic<i64> bottom;
+    std::atomic<Array *> array;
+    std::vector<Array *> retired; // old arrays may still be read by thieves, freed with the deque
+};
+
+// vyukov's bounded multi producer multi consumer queue
+class InjectionQueue {
+public:
+    explicit InjectionQueue(u64 capacity);
+    ~InjectionQueue();
+    bool push(PoolTask *task);
+    PoolTask *pop();
+private:
+    struct Cell { std::atomic<u64> sequence; PoolTask *task; };
+    Cell *cells;
+    u64 mask;
+    alignas(64) std::atomic<u64> enqueue_pos;
+    alignas(64) std::atomic<u64> dequeue_pos;
+};
+
+class ThreadPool {
+public:
+    static constexpr u64 INJECTION_CAPACITY = 1 << 16;
+
+    // pinned workers are bound one per cpu, filling the physical cores of a numa node
+    // and l3 domain before moving to the next and using smt siblings last;
+    // they then steal from the workers sharing their cache first.
+    explicit ThreadPool(u32 n_threads, bool pin = false);
+    ~ThreadPool();
+    // the pool shared by the renderer and the buffer operations, sized by defaultThreadCount
+    // and pinned when FEX_PIN_THREADS=1
+    static ThreadPool &shared();
+    // FEX_THREADS if set, else the cpus this process may run on
+    static u32 defaultThreadCount();
+
+    u32 size() const { return workers.size(); }
+    // from a worker the task goes on its own deque, from anywhere else on the injection queue
+    void submit(std::function<void()> f, TaskGroup *group = nullptr);
+    // runs queued tasks while waiting, so it may be called from inside a task as well
+    void wait(TaskGroup &group);
+
+    // body(first, last) over [begin, end) in chunks of grain, returns when all chunks ran
+    template <typename F>
+    void parallelFor(i32 begin, i32 end, i32 grain, F body) {
+        TaskGroup group;
+        grain = max(1, grain);
+        for (i32 i = begin; i < end; i += grain) {
+            i32 last = min(i + grain, end);
+            submit([i, last, &body] { body(i, last); }, &group);
+        }
+        wait(group);
+    }
+
+private:
+    void workerLoop(u32 index);
+    PoolTask *findTask(i32 self);
+    void run(PoolTask *task);
+    void wake();
+
+    std::vector<std::thread> workers;
+    std::vector<WorkStealingDeque *> deques;
+    std::vector<std::vector<u32>> victims; // steal order of each worker
+    InjectionQueue injection;
+    std::atomic<bool> alive = true;
+
+    std::atomic<u64> epoch = 0;   // bumped on every submit, sleepers wait for it to move
+    std::atomic<u32> sleepers = 0;
+    std::mutex sleep_lock;
+    std::condition_variable sleep_condition;
+};
+
+#endif // thread_pool_h
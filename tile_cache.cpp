@@ -0,0 +1,106 @@
+#include <tile_cache.h>
+#include <algorithm>
+#include <cstdlib>
+#include <cstring>
+
+u64 TileKeyHash::operator()(const TileKey &k) const {
+    auto mix = [](u64 h, u64 v) {
+        h ^= v + 0x9e3779b97f4a7c15ull + (h << 6) + (h >> 2);
+        return h;
+    };
+    u64 cx, cy, spacing;
+    std::memcpy(&cx, &k.c.x, sizeof(cx));
+    std::memcpy(&cy, &k.c.y, sizeof(cy));
+    std::memcpy(&spacing, &k.spacing, sizeof(spacing));
+    u64 h = mix(k.julia, cx);
+    h = mix(h, cy);
+    h = mix(h, k.max_iterations);
+    h = mix(h, k.fast_smoothing);
+    h = mix(h, spacing);
+    h = mix(h, (u64)k.x);
+    return mix(h, (u64)k.y);
+}
+
+CacheTile::CacheTile() {
+    std::fill(iterations, iterations + TILE_SIZE * TILE_SIZE, NOT_COMPUTED);
+}
+
+u64 TileCache::defaultBudget() {
+    if (const char *env = getenv("FEX_CACHE_MB")) return (u64)atoll(env) << 20;
+    return DEFAULT_BUDGET_MB << 20;
+}
+
+TileCache::TileCache(u64 budget_bytes) {
+    setBudget(budget_bytes);
+}
+
+void TileCache::setBudget(u64 budget_bytes) {
+    std::lock_guard<std::mutex> guard(lock);
+    max_tiles = budget_bytes / sizeof(CacheTile);
+    evict();
+}
+
+std::shared_ptr<CacheTile> TileCache::acquire(const TileKey &key) {
+    std::lock_guard<std::mutex> guard(lock);
+    auto it = tiles.find(key);
+    if (it != tiles.end()) {
+        recent.splice(recent.begin(), recent, it->second);
+        return it->second->second;
+    }
+    auto tile = std::make_shared<CacheTile>();
+    if (max_tiles == 0) return tile;
+    fillFromFiner(key, *tile);
+    recent.emplace_front(key, tile);
+    tiles[key] = recent.begin();
+    evict();
+    return tile;
+}
+
+// with the lock held. sample (x, y) of a spacing is sample (x << d, y << d) of the spacing
+// 2^d times smaller, a tile spans 2^d x 2^d tiles there
+void TileCache::fillFromFiner(const TileKey &key, CacheTile &tile) {
+    constexpr i32 S = CacheTile::TILE_SIZE;
+    for (i32 depth = 1; depth <= FINER_LEVELS; ++depth) {
+        i32 n = 1 << depth, part = S >> depth;
+        for (i32 j = 0; j < n; ++j) {
+            for (i32 i = 0; i < n; ++i) {
+                TileKey k = key;
+                k.spacing = ldexp(key.spacing, -depth);
+                k.x = (key.x << depth) + i;
+                k.y = (key.y << depth) + j;
+                auto it = tiles.find(k);
+                if (it == tiles.end()) continue;
+                const CacheTile &finer = *it->second->second;
+                for (i32 y = 0; y < part; ++y) {
+                    for (i32 x = 0; x < part; ++x) {
+                        i32 from = (y << depth) * S + (x << depth);
+                        i32 to = (j * part + y) * S + i * part + x;
+                        if (finer.iterations[from] == CacheTile::NOT_COMPUTED) continue;
+                        tile.iterations[to] = finer.iterations[from];
+                        tile.smooth[to] = finer.smooth[from];
+                    }
+                }
+            }
+        }
+    }
+}
+
+// with the lock held
+void TileCache::evict() {
+    while (recent.size() > max_tiles) {
+        tiles.erase(recent.back().first);
+        recent.pop_back();
+    }
+}
+
+TileCursor::TileCursor(TileCache &cache, const TileKey &key) : cache(cache), key(key) {}
+
+CacheTile *TileCursor::fetch(i64 tile_x, i64 tile_y) {
+    TileKey k = key;
+    k.x = tile_x;
+    k.y = tile_y;
+    held.push_back(cache.acquire(k));
+    recent[next_slot] = {tile_x, tile_y, held.back().get()};
+    next_slot = (next_slot + 1) % RECENT_TILES;
+    return held.back().get();
+}
@@ -0,0 +1,111 @@
+#ifndef tile_cache_h
+#define tile_cache_h
+
+#include <extramath.h>
+#include <atomic>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <unordered_map>
+#include <vector>
+
+// iteration counts kept across views in fractal space.
+// the explorer puts its pixels on the grid of their size through the origin, sample
+// (x, y) of a spacing being the pixel at (x, y) * spacing. views of the same pixel size
+// share the samples, and a cached count is always the one of the pixel: its coordinates
+// are the same bits. a tile groups TILE_SIZE x TILE_SIZE neighbouring samples.
+// halving the spacing keeps every sample, sample (x, y) is sample (2x, 2y) of the
+// spacing half as large, so a new tile takes what the finer spacings already have.
+// the key holds all a count depends on, so views of other fractals, iteration
+// limits or smoothings never mix.
+
+struct TileKey {
+    // the fractal the counts belong to
+    bool julia;
+    Vec2<f64> c;
+    u32 max_iterations;
+    bool fast_smoothing;
+    // the tile
+    f64 spacing;
+    i64 x, y;
+    bool operator==(const TileKey &k) const {
+        return julia == k.julia && c.x == k.c.x && c.y == k.c.y && max_iterations == k.max_iterations
+            && fast_smoothing == k.fast_smoothing && spacing == k.spacing && x == k.x && y == k.y;
+    }
+};
+
+struct TileKeyHash {
+    u64 operator()(const TileKey &k) const;
+};
+
+struct CacheTile {
+    static constexpr i32 TILE_SHIFT = 6;
+    static constexpr i32 TILE_SIZE = 1 << TILE_SHIFT;
+    static constexpr u32 NOT_COMPUTED = UINT32_MAX;
+    CacheTile();
+    u32 iterations[TILE_SIZE * TILE_SIZE]; // NOT_COMPUTED for samples no view needed yet
+    f32 smooth[TILE_SIZE * TILE_SIZE];
+};
+
+// least recently used tiles are dropped past the memory budget. tiles are handed out
+// shared, so one dropped while a worker still fills it lives until the worker is done.
+// the samples themselves are not locked: distinct pixels of a view never share a sample
+// and views are drawn one at a time.
+class TileCache {
+public:
+    static constexpr u64 DEFAULT_BUDGET_MB = 256;
+    // FEX_CACHE_MB if set, 0 turns the cache off
+    static u64 defaultBudget();
+
+    explicit TileCache(u64 budget_bytes = defaultBudget());
+    // 0 disables the cache and drops every tile
+    void setBudget(u64 budget_bytes);
+    bool enabled() const { return max_tiles > 0; }
+
+    // the cached tile, or a new one holding the samples the finer spacings already have
+    std::shared_ptr<CacheTile> acquire(const TileKey &key);
+
+private:
+    static constexpr i32 FINER_LEVELS = 2; // halvings looked up to fill a new tile, so zooming out hits
+    using Entry = std::pair<TileKey, std::shared_ptr<CacheTile>>;
+    void fillFromFiner(const TileKey &key, CacheTile &tile);
+    void evict();
+
+    std::mutex lock;
+    std::atomic<u64> max_tiles;
+    std::list<Entry> recent; // most recently used first
+    std::unordered_map<TileKey, std::list<Entry>::iterator, TileKeyHash> tiles;
+};
+
+// reads and fills the samples of one spacing. it remembers the last tiles it touched,
+// the pixels of a work unit fall in a handful of them. the tiles it handed out stay
+// alive as long as the cursor, even if the cache drops them.
+class TileCursor {
+public:
+    static constexpr i32 RECENT_TILES = 8;
+    // key holds the fractal and spacing of the tiles, its position is ignored
+    TileCursor(TileCache &cache, const TileKey &key);
+    // the tile holding sample (x, y), created if missing, and its index in it
+    inline CacheTile *at(i64 x, i64 y, i32 &index) {
+        constexpr i64 mask = CacheTile::TILE_SIZE - 1;
+        i64 tile_x = x >> CacheTile::TILE_SHIFT, tile_y = y >> CacheTile::TILE_SHIFT;
+        index = (i32)((y & mask) * CacheTile::TILE_SIZE + (x & mask));
+        for (Slot &slot : recent) {
+            if (slot.tile && slot.x == tile_x && slot.y == tile_y) return slot.tile;
+        }
+        return fetch(tile_x, tile_y);
+    }
+private:
+    struct Slot {
+        i64 x, y;
+        CacheTile *tile = nullptr;
+    };
+    CacheTile *fetch(i64 tile_x, i64 tile_y);
+    TileCache &cache;
+    TileKey key;
+    Slot recent[RECENT_TILES];
+    i32 next_slot = 0;
+    std::vector<std::shared_ptr<CacheTile>> held;
+};
+
+#endif // tile_cache_h
@@ -8,10 +8,9 @@
 void blitBuffer(Buffer *dest, Buffer *src) {
     i32 max_x = min(dest->width, src->width);
     i32 max_y = min(dest->height, src->height);
+    if (max_x <= 0) return;
     for (i32 y = 0; y < max_y; ++y) {
-        for (i32 x = 0; x < max_x; ++x) {
-            dest->data[(y * dest->width) + x] = src->data[(y * src->width) + x];
-        }
+        std::memcpy(dest->data + y * dest->width, src->data + y * src->width, max_x * sizeof(u32));
     }
 }
 
@@ -20,6 +19,7 @@ void blitBuffer(Buffer *dest, Buffer *src) {
 #include <sys/stat.h>
 #include <dlfcn.h>
 #include <fcntl.h>
+#include <poll.h>
 #include <unistd.h>
 
 static void randname(char *buf) {
@@ -47,23 +47,11 @@ static i32 create_shm_file(void) {
     return -1;
 }
 
-static i32 allocate_shm_file(usize size) {
-    i32 fd = create_shm_file();
-    if (fd < 0)
-        return -1;
-    i32 ret;
-    do {
-        ret = ftruncate(fd, size);
-    } while (ret < 0 && errno == EINTR);
-    if (ret < 0) {
-        close(fd);
-        return -1;
-    }
-    return fd;
-}
+static constexpr DamageRect ALL_DAMAGED = {0, INT32_MAX, 0, INT32_MAX};
 
 struct WindowHandle {
     Buffer *canvas;
+    CanvasDamage *canvas_damage; // null if the drawer does not record it
     Vec2<i32> size;
     bool should_close;
     f64 delta_frame;
@@ -82,15 +70,32 @@ struct WindowHandle {
         u32 serial;
         bool ack_configure, was_resize;
     } todo;
+    // a ring of shm buffers, current is the next one to present or -1 while all are
+    // held by the compositor
     struct {
         i32 current;
+        i32 count;
         struct {
             wl_buffer *handle;
             i32 width, height;
+            usize offset; // in the shm pool
             u32 *data;
             bool held;
-        } buf[2];
+            // canvas regions changed since the buffer was last presented
+            std::vector<DamageRect> pending;
+        } buf[Window::MAX_BUFFERS];
     } fb;
+    // a single shm file and pool for all the buffers, each in a slot of the same size.
+    // the slots start at base, they move past the end of the pool when they grow while
+    // the compositor still holds buffers in the old ones
+    struct {
+        i32 fd;
+        wl_shm_pool *pool;
+        u8 *data;
+        usize size;
+        usize base;
+        usize slot_size;
+    } shm;
     struct {
         Vec2<double> pointer;
         Vec2<double> pointer_delta;
@@ -155,36 +160,112 @@ static const struct wl_buffer_listener wl_buffer_listener = {
 };
 
 
+// makes room for buffers of buffer_size bytes, half as much again to spare so the
+// following resizes fit. the pool grows by a resize and a remap, it cannot shrink
+static bool growShm(WindowHandle *w, usize buffer_size) {
+    usize page = sysconf(_SC_PAGESIZE);
+    usize slot_size = (buffer_size + buffer_size / 2 + page - 1) / page * page;
+    bool held = false;
+    for (i32 i = 0; i < w->fb.count; ++i) held = held || w->fb.buf[i].held;
+    usize base = held ? w->shm.size : 0;
+    usize size = base + slot_size * w->fb.count;
+    if (size > w->shm.size) {
+        i32 ret;
+        do {
+            ret = ftruncate(w->shm.fd, size);
+        } while (ret < 0 && errno == EINTR);
+        if (ret < 0) return false;
+        void *data = w->shm.data ? mremap(w->shm.data, w->shm.size, size, MREMAP_MAYMOVE)
+                                 : mmap(nullptr, size, PROT_READ | PROT_WRITE, MAP_SHARED, w->shm.fd, 0);
+        if (data == MAP_FAILED) return false;
+        if (w->shm.pool) {
+            wl_shm_pool_resize(w->shm.pool, size);
+        } else {
+            w->shm.pool = wl_shm_create_pool(w->wl.shm, w->shm.fd, size);
+        }
+        w->shm.data = (u8 *)data;
+        w->shm.size = size;
+        for (i32 i = 0; i < w->fb.count; ++i) {
+            w->fb.buf[i].data = (u32 *)(w->shm.data + w->fb.buf[i].offset);
+        }
+    }
+    w->shm.base = base;
+    w->shm.slot_size = slot_size;
+    return true;
+}
+
+// (re)creates a buffer of the window size in its slot of the pool. the memory is not
+// cleared: the whole canvas is copied in before it is shown, XRGB ignores the alpha of
+// what lies outside it
 bool allocateWindowBuffer(WindowHandle *w, i32 index) {
-    usize buffer_size = w->size.x * 4 * w->size.y;
-    i32 fd = allocate_shm_file(buffer_size);
-    if (fd == -1) return false;
-    u32 *data = (u32*)mmap(nullptr, buffer_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
-    if (data == MAP_FAILED) return false;
-    wl_shm_pool *pool = wl_shm_create_pool(w->wl.shm, fd, buffer_size);
-    wl_buffer *buffer = wl_shm_pool_create_buffer(pool, 0, w->size.x, w->size.y, 4 * w->size.x, WL_SHM_FORMAT_ARGB8888);
-    if (!buffer) return false;
-    for (i32 i = 0; i < w->size.x * w->size.y; ++i) { data[i] = 0xff000000; }
-    wl_buffer_add_listener(buffer, &wl_buffer_listener, w);
-    w->fb.buf[index].data = data;
-    w->fb.buf[index].handle = buffer;
-    w->fb.buf[index].width = w->size.x;
-    w->fb.buf[index].height = w->size.y;
-    w->fb.buf[index].held = false;
-    wl_shm_pool_destroy(pool);
-    close(fd);
+    auto &buf = w->fb.buf[index];
+    usize stride = 4 * (usize)w->size.x, buffer_size = stride * w->size.y;
+    if (buffer_size > w->shm.slot_size && !growShm(w, buffer_size)) return false;
+    if (buf.handle) wl_buffer_destroy(buf.handle);
+    buf.offset = w->shm.base + index * w->shm.slot_size;
+    buf.data = (u32 *)(w->shm.data + buf.offset);
+    buf.handle = wl_shm_pool_create_buffer(w->shm.pool, buf.offset, w->size.x, w->size.y, stride, WL_SHM_FORMAT_XRGB8888);
+    if (!buf.handle) return false;
+    wl_buffer_add_listener(buf.handle, &wl_buffer_listener, w);
+    buf.width = w->size.x;
+    buf.height = w->size.y;
+    buf.held = false;
+    buf.pending.assign(1, ALL_DAMAGED);
     return true;
 }
 
+// brings a window buffer up to date with the canvas and damages what changed on the surface.
+// the changes since the last frame are due in both buffers, the other one takes them later
+static void copyCanvas(WindowHandle *w, i32 index) {
+    auto &buf = w->fb.buf[index];
+    if (!w->canvas) return;
+    if (w->canvas_damage) {
+        std::vector<DamageRect> fresh;
+        w->canvas_damage->take(fresh);
+        for (i32 i = 0; i < w->fb.count; ++i) {
+            auto &b = w->fb.buf[i];
+            b.pending.insert(b.pending.end(), fresh.begin(), fresh.end());
+            if (b.pending.size() > CanvasDamage::MAX_RECTS) b.pending.assign(1, ALL_DAMAGED);
+        }
+    } else {
+        buf.pending.assign(1, ALL_DAMAGED);
+    }
+    // a buffer larger than the canvas, until the drawer resizes it, is black around it
+    i32 width = min(buf.width, w->canvas->width), height = min(buf.height, w->canvas->height);
+    for (DamageRect r : buf.pending) {
+        r = {max(r.min_x, 0), min(r.max_x, buf.width), max(r.min_y, 0), min(r.max_y, buf.height)};
+        if (r.min_x >= r.max_x || r.min_y >= r.max_y) continue;
+        for (i32 y = r.min_y; y < r.max_y; ++y) {
+            u32 *row = buf.data + (usize)y * buf.width;
+            i32 copied = y < height ? max(0, min(r.max_x, width) - r.min_x) : 0;
+            if (copied > 0) {
+                std::memcpy(row + r.min_x, w->canvas->data + (usize)y * w->canvas->width + r.min_x, copied * sizeof(u32));
+            }
+            std::memset(row + r.min_x + copied, 0, (r.max_x - r.min_x - copied) * sizeof(u32));
+        }
+        wl_surface_damage_buffer(w->wl.surface, r.min_x, r.min_y, r.max_x - r.min_x, r.max_y - r.min_y);
+    }
+    buf.pending.clear();
+}
+
+// marks the current buffer held by the compositor and moves to the next free one in the ring
+static void advanceBuffer(WindowHandle *w) {
+    i32 presented = w->fb.current;
+    w->fb.buf[presented].held = true;
+    w->fb.current = -1;
+    for (i32 i = 1; i < w->fb.count; ++i) {
+        i32 index = (presented + i) % w->fb.count;
+        if (!w->fb.buf[index].held) {
+            w->fb.current = index;
+            break;
+        }
+    }
+}
+
 static void ackXdgSurfaceConfigure(WindowHandle *w, xdg_surface *surface, u32 serial) {
     wl_buffer *handle = w->fb.buf[w->fb.current].handle;
-    if (w->canvas) {
-        Buffer wrapper{w->fb.buf[w->fb.current].data, w->fb.buf[w->fb.current].width, w->fb.buf[w->fb.current].height };
-        blitBuffer(&wrapper, w->canvas);
-    }
-    w->fb.buf[w->fb.current].held = true;
-    w->fb.current = (w->fb.current + 1) % 2;
-    if (w->fb.buf[w->fb.current].held) w->fb.current = -1;
+    copyCanvas(w, w->fb.current);
+    advanceBuffer(w);
     wl_surface_attach(w->wl.surface, handle, 0, 0);
     wl_surface_commit(w->wl.surface);
     xdg_surface_ack_configure(surface, serial);
@@ -195,12 +276,11 @@ static void ackXdgSurfaceConfigure(WindowHandle *w, xdg_surface *surface, u32 se
 
 static void wlBufferHandleRelease(void *data, wl_buffer *buffer) {
     WindowHandle *w = (WindowHandle*)data;
-    i32 index = buffer == w->fb.buf[0].handle ? 0 : 1;
+    i32 index = 0;
+    while (index < w->fb.count - 1 && w->fb.buf[index].handle != buffer) ++index;
     w->fb.buf[index].held = false;
     // probably the right moment to resize it if it is to be resized
     if (w->fb.buf[index].width != w->size.x || w->fb.buf[index].height != w->size.y) {
-        munmap(w->fb.buf[index].data, w->fb.buf[index].width * w->fb.buf[index].height * 4);
-        wl_buffer_destroy(w->fb.buf[index].handle);
         allocateWindowBuffer(w, index);
     }
     if (w->fb.current == -1) w->fb.current = index;
@@ -214,9 +294,8 @@ static void xdgSurfaceHandleConfigure(void *data, xdg_surface *surface, u32 seri
     // this is the final configure call, where we handle all accumulated state from the
     // toplevel configure calls
     WindowHandle *w = (WindowHandle*)data;
-    for (u8 i = 0; i < 2; ++i) {
+    for (i32 i = 0; i < w->fb.count; ++i) {
         if (!w->fb.buf[i].held && (w->fb.buf[i].width != w->size.x || w->fb.buf[i].height != w->size.y)) {
-            munmap(w->fb.buf[i].data, w->fb.buf[i].width * w->fb.buf[i].height * 4);
             allocateWindowBuffer(w, i);
         }
     }
@@ -338,22 +417,11 @@ const struct wl_callback_listener frame_listener = {
 static void frameHandleDone(void *data, wl_callback *cb, u32 callback_data) {
     WindowHandle *w = (WindowHandle*)data;
     if (w->fb.current != -1) {
-        if (w->canvas) {
-            Buffer wrapper{
-                w->fb.buf[w->fb.current].data, 
-                w->fb.buf[w->fb.current].width, 
-                w->fb.buf[w->fb.current].height 
-            };
-            blitBuffer(&wrapper, w->canvas);
-        }
-
         wl_buffer *handle = w->fb.buf[w->fb.current].handle;
         wl_surface_attach(w->wl.surface, handle, 0, 0);
-        wl_surface_damage_buffer(w->wl.surface, 0, 0, INT32_MAX, INT32_MAX);
+        copyCanvas(w, w->fb.current);
         wl_surface_commit(w->wl.surface);
-        w->fb.buf[w->fb.current].held = true;
-        w->fb.current = (w->fb.current + 1) % 2;
-        if (w->fb.buf[w->fb.current].held) w->fb.current = -1;
+        advanceBuffer(w);
     }
     wl_callback_destroy(cb);
     cb = wl_surface_frame(w->wl.surface);
@@ -361,12 +429,18 @@ static void frameHandleDone(void *data, wl_callback *cb, u32 callback_data) {
 }
 
 void destroyWindowHandle(WindowHandle *w) {
+    for (i32 i = 0; i < w->fb.count; ++i) {
+        if (w->fb.buf[i].handle) wl_buffer_destroy(w->fb.buf[i].handle);
+    }
+    if (w->shm.pool) wl_shm_pool_destroy(w->shm.pool);
+    if (w->shm.data) munmap(w->shm.data, w->shm.size);
+    if (w->shm.fd >= 0) close(w->shm.fd);
     wl_shm_destroy(w->wl.shm);
     wl_display_disconnect(w->wl.display);
     delete w;
 }
 
-Window::Window(i32 width, i32 height, const char *title) {
+Window::Window(i32 width, i32 height, const char *title, i32 buffers) {
     WindowHandle *w = new WindowHandle;
     w->size.x = width;
     w->size.y = height;
@@ -378,6 +452,7 @@ Window::Window(i32 width, i32 height, const char *title) {
     w->wl.seat = nullptr;
     w->wl.pointer = nullptr;
     w->canvas = nullptr;
+    w->canvas_damage = nullptr;
     w->frame_events.resized = false;
     w->input.pointer = {0, 0};
     w->input.pointer_delta = {0, 0};
@@ -407,13 +482,15 @@ Window::Window(i32 width, i32 height, const char *title) {
     xdg_toplevel_set_title(toplevel, title);
     xdg_toplevel_add_listener(toplevel, &xdg_toplevel_listener, w);
 
-    if (!allocateWindowBuffer(w, 0)) {
-        destroyWindowHandle(w);
-        handle = nullptr;
-    }
-    if (!allocateWindowBuffer(w, 1)) {
-        destroyWindowHandle(w);
-        handle = nullptr;
+    w->fb.count = max(2, min(buffers, MAX_BUFFERS));
+    for (i32 i = 0; i < w->fb.count; ++i) w->fb.buf[i] = {};
+    w->shm = {create_shm_file(), nullptr, nullptr, 0, 0, 0};
+    for (i32 i = 0; i < w->fb.count; ++i) {
+        if (!allocateWindowBuffer(w, i)) {
+            destroyWindowHandle(w);
+            handle = nullptr;
+            return;
+        }
     }
 
     w->fb.current = 0;
@@ -434,7 +511,7 @@ bool Window::openedSuccesfully() {
     return handle != nullptr;
 } 
 
-void Window::update() {
+void Window::update(i32 timeout_ms) {
     WindowHandle *w = (WindowHandle *)handle;
     w->frame_events.resized = false;
     w->frame_events.axis = {0, 0};
@@ -446,7 +523,30 @@ void Window::update() {
         }
     }
 
-    wl_display_dispatch(w->wl.display);
+    // wait for events up to the timeout, then handle all those queued. the frame
+    // callbacks present the canvas, the loop of the caller does not wait for them
+    wl_display *display = w->wl.display;
+    while (wl_display_prepare_read(display) != 0) {
+        if (wl_display_dispatch_pending(display) < 0) {
+            w->should_close = true;
+            return;
+        }
+    }
+    wl_display_flush(display);
+    pollfd fd = {wl_display_get_fd(display), POLLIN, 0};
+    i32 ready = poll(&fd, 1, timeout_ms);
+    if (ready > 0 && (fd.revents & (POLLHUP | POLLERR))) {
+        // the compositor is gone, close instead of polling a dead socket
+        wl_display_cancel_read(display);
+        w->should_close = true;
+        return;
+    }
+    if (ready > 0 && (fd.revents & POLLIN)) {
+        if (wl_display_read_events(display) < 0) w->should_close = true;
+    } else {
+        wl_display_cancel_read(display);
+    }
+    if (wl_display_dispatch_pending(display) < 0) w->should_close = true;
 }
 
 bool Window::shouldClose() {
@@ -477,6 +577,9 @@ Vec2<f64> Window::scrollVector() {
     return ((WindowHandle *)handle)->frame_events.axis;
 }
 
-void Window::setCanvas(Buffer *canvas) {
-    ((WindowHandle *)handle)->canvas = canvas;
+void Window::setCanvas(Buffer *canvas, CanvasDamage *damage) {
+    WindowHandle *w = (WindowHandle *)handle;
+    w->canvas = canvas;
+    w->canvas_damage = damage;
+    for (i32 i = 0; i < w->fb.count; ++i) w->fb.buf[i].pending.assign(1, ALL_DAMAGED);
 }
@@ -3,6 +3,8 @@
 
 #include <cstdint>
 #include <cstddef>
+#include <mutex>
+#include <vector>
 
 typedef uint8_t u8;
 typedef uint16_t u16;
@@ -88,15 +90,40 @@ void fillBuffer(Buffer *buf, Color color);
 void zoomBufferInterpolate(Buffer *b, i32 focus_x, i32 focus_y, f32 zoom);
 void blurBufferGaussian(Buffer *buf, u8 kernel_size, f32 sigma);
 
+// the pixels min <= (x, y) < max of a buffer
+struct DamageRect { i32 min_x, max_x, min_y, max_y; };
+// the regions of a canvas changed since the window last took them. drawing threads add
+// each rectangle once they finished painting it, the window copies and damages only those
+class CanvasDamage {
+public:
+    void add(DamageRect rect);
+    void addAll();
+    // appends the changed rectangles to out and forgets them. past MAX_RECTS they are
+    // merged in their bounding box, the whole canvas is INT32_MAX wide and high
+    void take(std::vector<DamageRect> &out);
+    static constexpr usize MAX_RECTS = 64;
+private:
+    std::mutex lock;
+    std::vector<DamageRect> rects;
+};
+
 // una window potrebbe avere modes: tipo opengl e scegli versione, vulkan, canvas
 class Window {
 public:
-    Window(i32 width, i32 height, const char *title);
+    static constexpr i32 MAX_BUFFERS = 4;
+    // buffers is the depth of the ring of shm buffers the canvas is presented through,
+    // 2 to MAX_BUFFERS. with more of them a frame is rarely dropped while the compositor
+    // holds the others
+    Window(i32 width, i32 height, const char *title, i32 buffers = 3);
     ~Window();
-    void setCanvas(Buffer *canvas);
+    // the window shows the canvas, copying all of it on every frame. with the damage the
+    // drawer records it copies and damages only the regions that changed
+    void setCanvas(Buffer *canvas, CanvasDamage *damage = nullptr);
     Vec2<i32> size();
     bool openedSuccesfully(); // the window opened 
-    void update(); // call in your loop to update the window
+    // call in your loop to update the window. handles the pending events, waiting at most
+    // timeout_ms for one, so the loop keeps running whatever the compositor does
+    void update(i32 timeout_ms = 16);
     bool shouldClose(); 
     bool wasResized();
 